@@ -0,0 +1,1049 @@
+/*
+ * ttytimer-bench: measures what ttytimer costs to draw, resize, serve
+ * and start.
+ *
+ * It is built with ttytimer.c linked in (see the Makefile's bench
+ * targets), so each benchmark drives the real drawing and event code on
+ * pseudo terminals of its own. Results go to stdout, one JSON object per
+ * line for the ones make bench collects.
+ */
+
+#define _GNU_SOURCE
+#include <sys/resource.h>
+
+#include "ttytimer.h"
+
+/* The ttytimer binary bench_startup() launches */
+static const char *ttytimer_path = "./ttytimer";
+
+/* Draws a digit cell by cell, decoding the font's bits, the way
+ * draw_number() did before the glyph cache. Only used by bench_glyphs(). */
+static void draw_number_cells(WINDOW *win, int n, int x, int y,
+                              unsigned int color) {
+        const font_t *font = ttyclock->option.font;
+        int row, col, lit;
+
+        for (row = 0; row < font->h; ++row)
+                for (col = 0; col < font->w; ++col) {
+                        if (ttyclock->option.bold) wattron(win, A_BLINK);
+                        else wattroff(win, A_BLINK);
+
+                        lit = font->bits[n][row] >> (font->w - 1 - col) & 1;
+                        wbkgdset(win, COLOR_PAIR(lit * color));
+                        mvwaddch(win, x + row, y + col, ' ');
+                }
+}
+
+/* Opens a pseudo terminal of the given size and returns its master side.
+ * The slave side is left in *slave. */
+static int open_pty(int rows, int cols, int *slave) {
+        struct winsize ws = { 0 };
+        int master;
+
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master == -1 || grantpt(master) || unlockpt(master)
+            || (*slave = open(ptsname(master), O_RDWR | O_NOCTTY)) == -1) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        ws.ws_row = rows;
+        ws.ws_col = cols;
+        ioctl(master, TIOCSWINSZ, &ws);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        return master;
+}
+
+/* Starts a child that throws away what the clock writes to a pseudo
+ * terminal, so the clock never blocks on a full one. */
+static pid_t drain_pty(int master) {
+        char buf[BUFSIZ];
+        pid_t pid = fork();
+
+        if (pid == 0) {
+                fcntl(master, F_SETFL, 0);
+                while (read(master, buf, sizeof(buf)) > 0);
+                _exit(EXIT_SUCCESS);
+        }
+
+        return pid;
+}
+
+/* Compares drawing whole digits cell by cell from the font's bits with
+ * copying them from the glyph cache, in every font. */
+static void bench_glyphs(void) {
+        const long frames = 200000;
+        struct timespec start, end;
+        countdown_t *t;
+        double ns[N_FONTS][2];
+        long f;
+        int font, pos, path;
+
+        add_timer("1:00:00");
+        t = &ttyclock->timer[0];
+        init_headless(open("/dev/null", O_RDWR));
+
+        for (font = 0; font < N_FONTS; ++font) {
+                ttyclock->option.font = &fonts[font];
+                build_glyphs();
+                set_center();
+
+                for (path = 0; path < 2; ++path) {
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+
+                        for (f = 0; f < frames; ++f) {
+                                for (pos = 0; pos < N_TIME_DIGITS; ++pos) {
+                                        int n = (f + pos) % 10;
+                                        int col = digit_col(pos);
+
+                                        if (path == 0) {
+                                                draw_number_cells(t->framewin,
+                                                                  n, 1, col, 1);
+                                        } else {
+                                                t->drawn.digit[pos] = -1;
+                                                draw_number(t, pos, n, 1, col,
+                                                            1);
+                                        }
+                                }
+                        }
+
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        ns[font][path] = (double)ts_diff_ns(&end, &start)
+                                         / (frames * N_TIME_DIGITS);
+                }
+        }
+
+        endwin();
+
+        for (font = 0; font < N_FONTS; ++font)
+                printf("%-5s  cells: %8.1f ns/digit, "
+                       "glyph cache: %8.1f ns/digit (%.1fx)\n",
+                       fonts[font].name, ns[font][0], ns[font][1],
+                       ns[font][0] / ns[font][1]);
+}
+
+/* Returns the resident set size in kB. */
+static long rss_kb(void) {
+        long pages = 0, resident = 0;
+        FILE *f = fopen("/proc/self/statm", "r");
+
+        if (f) {
+                if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+                fclose(f);
+        }
+
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Sends a storm of SIGWINCHs to a clock drawn on a pseudo terminal whose
+ * size keeps changing, and reports memory use before and after. */
+static void bench_resize(void) {
+        const int storms = 5000;
+        struct winsize ws = { 0 };
+        struct timespec start, end;
+        long before, after;
+        int master, slave, i;
+        pid_t drain;
+
+        master = open_pty(24, 80, &slave);
+        drain = drain_pty(master);
+
+        add_timer("1:00:00");
+        init_events();
+        init_headless(slave);
+
+        draw_timers();
+        before = rss_kb();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < storms; ++i) {
+                ws.ws_row = 24 + i % 17;
+                ws.ws_col = 80 + i % 43;
+                ioctl(master, TIOCSWINSZ, &ws);
+                raise(SIGWINCH);
+
+                handle_signals();
+                draw_timers();
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        after = rss_kb();
+
+        endwin();
+        kill(drain, SIGTERM);
+
+        printf("resizes: %d, %.1f us/resize\n"
+               "rss before: %ld kB, after: %ld kB\n",
+               storms, ts_diff_ns(&end, &start) / 1e3 / storms,
+               before, after);
+}
+
+/* Runs the tick loop of the timers for secs seconds and returns the CPU
+ * time it took. */
+static double run_headless(double secs) {
+        struct pollfd fds[1] = {
+                { .fd = ttyclock->timerfd,  .events = POLLIN },
+        };
+        struct timespec start, now;
+        double cpu = cpu_seconds();
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        start_timers();
+
+        do {
+                draw_timers();
+                if (poll(fds, 1, -1) > 0) handle_tick();
+                clock_gettime(CLOCK_MONOTONIC, &now);
+        } while (ts_diff_ns(&now, &start) < secs * NSEC_PER_SEC);
+
+        return cpu_seconds() - cpu;
+}
+
+/* Runs 100 timers in one process on a large pseudo terminal and reports
+ * the CPU time they cost per hour. */
+static void bench_timers(void) {
+        const int ntimers = 100;
+        const double secs = 10;
+        char arg[16];
+        double cpu;
+        int master, slave, i;
+        pid_t drain;
+
+        master = open_pty(200, 600, &slave);
+        drain = drain_pty(master);
+
+        for (i = 0; i < ntimers; ++i) {
+                snprintf(arg, sizeof(arg), "%d:%02d:00", 1 + i / 60, i % 60);
+                add_timer(arg);
+        }
+
+        init_events();
+        init_headless(slave);
+
+        cpu = run_headless(secs);
+
+        endwin();
+        kill(drain, SIGTERM);
+
+        printf("timers: %d, ticks: %lu, wakeups: %lu\n"
+               "cpu: %.3f s/hour\n",
+               ntimers, ttyclock->drift.ticks, ttyclock->drawn.frames,
+               cpu / secs * 3600);
+}
+
+/* Runs a timer showing hundredths of seconds for a while, and reports
+ * the frame rate it kept up and the CPU time that cost. */
+static void bench_fraction(void) {
+        const double secs = 5;
+        double cpu;
+        int master, slave;
+        pid_t drain;
+
+        master = open_pty(24, 80, &slave);
+        drain = drain_pty(master);
+
+        ttyclock->option.frac = 2;
+        add_timer("1:00:00");
+        init_events();
+        init_headless(slave);
+
+        cpu = run_headless(secs);
+
+        endwin();
+        kill(drain, SIGTERM);
+
+        printf("frames: %lu, %.1f/s, late max: %.3f ms\n"
+               "cpu: %.2f%%\n",
+               ttyclock->drawn.frames, ttyclock->drawn.frames / secs,
+               ttyclock->drift.max_ns / 1e6, cpu / secs * 100);
+}
+
+/* Asks the control socket at path for the status over and over, until
+ * killed. */
+static void ctl_hammer(const char *path) {
+        char buf[BUFSIZ];
+        int fd = ctl_connect(path);
+
+        while (fd != -1 && write(fd, "status\n", 7) == 7
+               && read(fd, buf, sizeof(buf)) > 0);
+
+        _exit(EXIT_SUCCESS);
+}
+
+/* Runs a timer showing hundredths of seconds, first alone and then with
+ * clients hammering the control socket, and compares how late its ticks
+ * were. */
+static void bench_ctl(void) {
+        const int nclients = 4;
+        const double secs = 5;
+        struct timespec start, now;
+        unsigned long requests;
+        static char path[64];
+        pid_t client[nclients], drain;
+        int master, slave, phase, i;
+
+        master = open_pty(24, 80, &slave);
+        drain = drain_pty(master);
+        /* Nothing is typed, but the main loop waits on stdin. */
+        dup2(slave, STDIN_FILENO);
+
+        snprintf(path, sizeof(path), "/tmp/ttytimer-bench-%d.sock", getpid());
+        ttyclock->ctl.path = path;
+        ttyclock->option.frac = 2;
+        ttyclock->option.stats = True;
+        add_timer("1:00:00");
+        init_events();
+        init_headless(slave);
+        ctl_open();
+
+        for (phase = 0; phase < 2; ++phase) {
+                for (i = 0; phase && i < nclients; ++i)
+                        if ((client[i] = fork()) == 0) ctl_hammer(path);
+
+                memset(&ttyclock->stats.late, 0, sizeof(hist_t));
+                requests = ttyclock->ctl.requests;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                start_timers();
+
+                do {
+                        draw_timers();
+                        wait_event();
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                } while (ts_diff_ns(&now, &start) < secs * NSEC_PER_SEC);
+
+                for (i = 0; phase && i < nclients; ++i) {
+                        kill(client[i], SIGKILL);
+                        waitpid(client[i], NULL, 0);
+                }
+
+                printf("%-8s requests: %8.0f/s, ticks: %lu, "
+                       "late p50: %.3f ms, p99: %.3f ms, max: %.3f ms\n",
+                       phase ? "loaded" : "idle",
+                       (ttyclock->ctl.requests - requests) / secs,
+                       ttyclock->stats.late.n,
+                       hist_pct(&ttyclock->stats.late, 0.50) / 1e6,
+                       hist_pct(&ttyclock->stats.late, 0.99) / 1e6,
+                       ttyclock->stats.late.max / 1e6);
+        }
+
+        endwin();
+        kill(drain, SIGTERM);
+}
+
+/* Reads and throws away what is waiting on a pseudo terminal's master
+ * side, and returns how many bytes that was. */
+static long drain_now(int master) {
+        char buf[BUFSIZ];
+        long total = 0;
+        ssize_t n;
+
+        while ((n = read(master, buf, sizeof(buf))) > 0) total += n;
+
+        return total;
+}
+
+/* Counts down one timer a second per frame on each backend and reports
+ * the bytes each sends to the terminal. */
+static void bench_backends(void) {
+        static const char *names[] = { "curses", "ansi" };
+        const int frames = 1000;
+        struct timespec now;
+        countdown_t *t;
+        long first, bytes;
+        int master, slave, b, f;
+
+        master = open_pty(24, 80, &slave);
+
+        add_timer("1:00:00");
+        t = &ttyclock->timer[0];
+
+        for (b = BACKEND_CURSES; b <= BACKEND_ANSI; ++b) {
+                ttyclock->option.backend = b;
+                if (b == BACKEND_ANSI) {
+                        ttyclock->ttyfd = slave;
+                        ansi_init();
+                } else {
+                        init_headless(slave);
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                t->deadline = now;
+                t->deadline.tv_sec += 3600;
+                memset(&ttyclock->drawn, 0, sizeof(ttyclock->drawn));
+                invalidate_clock(t);
+                drain_now(master);
+
+                t->dirty = True;
+                draw_timers();
+                first = bytes = drain_now(master);
+
+                for (f = 1; f < frames; ++f) {
+                        t->deadline.tv_sec -= 1;
+                        t->dirty = True;
+                        draw_timers();
+                        bytes += drain_now(master);
+                }
+
+                end_screen();
+                drain_now(master);
+
+                printf("%-6s first frame: %5ld bytes, then %6.1f bytes/frame,"
+                       " %5.1f cells/frame\n",
+                       names[b], first, (double)(bytes - first) / (frames - 1),
+                       (double)ttyclock->drawn.cells / frames);
+        }
+}
+
+/* Draws a timer on a range of terminal types and sizes, with and without
+ * box and bold, and writes a JSON object per combination to stdout: the
+ * time and bytes per frame, and what clock_move() and set_box() cost. */
+static void bench_render(void) {
+        static const char *terms[] = { "vt100", "xterm", "xterm-256color" };
+        static const int sizes[][2] = { { 24, 80 }, { 50, 132 }, { 60, 200 } };
+        const int frames = 2000, moves = 200;
+        struct timespec start, end, now;
+        long long frame_ns, move_ns, box_ns;
+        long first, bytes;
+        countdown_t *t;
+        int term, size, box, bold, master, slave, f;
+
+        add_timer("99:00:00");
+        t = &ttyclock->timer[0];
+        ttyclock->option.stats = True;
+
+        for (term = 0; term < 3; ++term)
+        for (size = 0; size < 3; ++size)
+        for (box = 0; box < 2; ++box)
+        for (bold = 0; bold < 2; ++bold) {
+                master = open_pty(sizes[size][0], sizes[size][1], &slave);
+                setenv("TERM", terms[term], 1);
+                ttyclock->option.box = box;
+                ttyclock->option.bold = bold;
+                init_headless(slave);
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                t->deadline = now;
+                t->deadline.tv_sec += t->duration;
+                memset(&ttyclock->stats.draw, 0, sizeof(hist_t));
+                drain_now(master);
+
+                t->dirty = True;
+                draw_timers();
+                first = drain_now(master);
+
+                frame_ns = 0;
+                bytes = 0;
+                for (f = 0; f < frames; ++f) {
+                        t->deadline.tv_sec -= 1;
+                        t->dirty = True;
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_timers();
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+
+                        frame_ns += ts_diff_ns(&end, &start);
+                        bytes += drain_now(master);
+                }
+
+                move_ns = box_ns = 0;
+                for (f = 0; f < moves; ++f) {
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        clock_move(t, t->geo.x + (f % 2 ? -1 : 1), t->geo.y,
+                                   t->geo.w, t->geo.h);
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        move_ns += ts_diff_ns(&end, &start);
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        set_box(!ttyclock->option.box);
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        box_ns += ts_diff_ns(&end, &start);
+
+                        draw_timers();
+                        drain_now(master);
+                }
+
+                endwin();
+                delscreen(ttyclock->ttyscr);
+                ttyclock->ttyscr = NULL;
+                close(slave);
+                close(master);
+
+                printf("{\"bench\": \"render\", \"term\": \"%s\", "
+                       "\"rows\": %d, \"cols\": %d, \"box\": %d, \"bold\": %d, "
+                       "\"frames\": %d, \"ns_per_frame\": %.0f, "
+                       "\"draw_clock_p50_ns\": %lld, "
+                       "\"first_frame_bytes\": %ld, \"bytes_per_frame\": %.1f, "
+                       "\"clock_move_ns\": %.0f, \"set_box_ns\": %.0f}\n",
+                       terms[term], sizes[size][0], sizes[size][1], box, bold,
+                       frames, (double)frame_ns / frames,
+                       hist_pct(&ttyclock->stats.draw, 0.50),
+                       first, (double)bytes / frames,
+                       (double)move_ns / moves, (double)box_ns / moves);
+        }
+}
+
+/* Prints time and bytes per frame with the timer mirrored to 0 to
+ * MAX_MIRRORS more terminals, with either backend. */
+static void bench_mirror(void) {
+        static const char *names[] = { "curses", "ansi" };
+        static const int counts[] = { 0, 1, 2, 4, MAX_MIRRORS };
+        const int frames = 1000;
+        int master[MAX_MIRRORS + 1], slave[MAX_MIRRORS + 1];
+        struct timespec start, end, now;
+        long long frame_ns;
+        long bytes, mbytes;
+        countdown_t *t;
+        int b, k, n, i, f;
+
+        add_timer("1:00:00");
+        t = &ttyclock->timer[0];
+        setenv("TERM", "xterm", 1);
+
+        for (b = BACKEND_CURSES; b <= BACKEND_ANSI; ++b)
+        for (k = 0; k < 5; ++k) {
+                n = counts[k];
+                for (i = 0; i <= n; ++i) master[i] = open_pty(24, 80, &slave[i]);
+
+                ttyclock->option.backend = b;
+                if (b == BACKEND_ANSI) {
+                        ttyclock->ttyfd = slave[0];
+                        ansi_init();
+                } else {
+                        init_headless(slave[0]);
+                }
+                for (i = 1; i <= n; ++i) mirror_open(slave[i]);
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                t->deadline = now;
+                t->deadline.tv_sec += 3600;
+                t->dirty = True;
+                draw_timers();
+                for (i = 0; i <= n; ++i) drain_now(master[i]);
+
+                frame_ns = 0;
+                bytes = mbytes = 0;
+                for (f = 0; f < frames; ++f) {
+                        t->deadline.tv_sec -= 1;
+                        t->dirty = True;
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_timers();
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+
+                        frame_ns += ts_diff_ns(&end, &start);
+                        bytes += drain_now(master[0]);
+                        for (i = 1; i <= n; ++i) mbytes += drain_now(master[i]);
+                }
+
+                end_screen();
+                for (i = 1; i <= n; ++i)
+                        if (ttyclock->mirror.term[i - 1].scr)
+                                delscreen(ttyclock->mirror.term[i - 1].scr);
+                ttyclock->mirror.n = 0;
+                if (b == BACKEND_CURSES) {
+                        delscreen(ttyclock->ttyscr);
+                        ttyclock->ttyscr = NULL;
+                }
+                for (i = 0; i <= n; ++i) {
+                        close(slave[i]);
+                        close(master[i]);
+                }
+
+                printf("%-6s %d mirrors: %6.1f us/frame, %5.1f bytes/frame, "
+                       "%5.1f per mirror\n",
+                       names[b], n, frame_ns / 1e3 / frames,
+                       (double)bytes / frames,
+                       n ? (double)mbytes / n / frames : 0.0);
+        }
+}
+
+/* Prints the cost of a --stream tick of 8 timers, as JSON and binary,
+ * to /dev/null and to a pipe nobody reads, where records get dropped. */
+static void bench_stream(void) {
+        static const char *sinks[] = { "/dev/null", "stalled pipe" };
+        const int ticks = 20000;
+        struct timespec start, end;
+        int binary, sink, f, i, p[2];
+
+        for (i = 0; i < 8; ++i) add_timer("1:00:00");
+        ttyclock->stream.buf = malloc(STREAM_BUFSIZE);
+        assert(ttyclock->stream.buf != NULL);
+        signal(SIGPIPE, SIG_IGN);
+
+        for (binary = 0; binary < 2; ++binary)
+        for (sink = 0; sink < 2; ++sink) {
+                if (sink == 0) {
+                        ttyclock->stream.fd = open("/dev/null", O_WRONLY);
+                } else if (pipe(p) == 0) {
+                        ttyclock->stream.fd = p[1];
+                        fcntl(p[1], F_SETFL, O_NONBLOCK);
+                }
+                ttyclock->stream.binary = binary;
+                ttyclock->stream.len = ttyclock->stream.sent = 0;
+                ttyclock->stream.seq = ttyclock->stream.dropped = 0;
+
+                start_timers();
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (f = 0; f < ticks; ++f) {
+                        for (i = 0; i < ttyclock->ntimers; ++i)
+                                ttyclock->timer[i].dirty = True;
+                        stream_timers();
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                close(ttyclock->stream.fd);
+                if (sink == 1) close(p[0]);
+
+                printf("%-6s to %-12s: %6.0f ns/tick, %llu records, "
+                       "%llu dropped\n",
+                       binary ? "binary" : "json", sinks[sink],
+                       (double)ts_diff_ns(&end, &start) / ticks,
+                       (unsigned long long)ttyclock->stream.seq,
+                       (unsigned long long)ttyclock->stream.dropped);
+        }
+}
+
+/* Waits for SIGCHLDs until at most n hooks are left running. */
+static void bench_reap(int n) {
+        struct pollfd fds[1] = {
+                { .fd = ttyclock->sigfd, .events = POLLIN },
+        };
+
+        while (ttyclock->hooks.running > n && poll(fds, 1, -1) >= 0)
+                handle_signals();
+}
+
+/* Prints what starting a hook costs the main loop with posix_spawn(),
+ * against system(), which waits for the command to finish, and what
+ * --hook-max does to a burst of hooks due at once. */
+static void bench_hooks(void) {
+        static const char *cmds[] = { "true", "sleep 0.02" };
+        char arg[] = "tea=0:01:00";
+        const int n = 100;
+        struct timespec start, end;
+        countdown_t *t;
+        int c, i;
+
+        init_events();
+        add_timer(arg);
+        t = &ttyclock->timer[0];
+        ttyclock->option.stats = True;
+        ttyclock->hooks.n = 1;
+        hook_init();
+
+        for (c = 0; c < 2; ++c) {
+                ttyclock->hooks.hook[0].cmd = cmds[c];
+                ttyclock->hooks.max = MAX_HOOK_PROCS;
+                memset(&ttyclock->stats.spawn, 0, sizeof(hist_t));
+                for (i = 0; i < n; ++i) {
+                        bench_reap(MAX_HOOK_PROCS - 1);
+                        hook_spawn(t, 0);
+                }
+                bench_reap(0);
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (i = 0; i < n; ++i)
+                        if (system(cmds[c]) == -1) break;
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                printf("%-10s: posix_spawn p50 %5.0f us, p99 %5.0f us; "
+                       "system() %6.0f us\n", cmds[c],
+                       hist_pct(&ttyclock->stats.spawn, 0.50) / 1e3,
+                       hist_pct(&ttyclock->stats.spawn, 0.99) / 1e3,
+                       ts_diff_ns(&end, &start) / 1e3 / n);
+        }
+
+        ttyclock->hooks.max = HOOK_PROCS;
+        ttyclock->hooks.started = ttyclock->hooks.skipped = 0;
+        for (i = 0; i < n; ++i) hook_spawn(t, 0);
+        bench_reap(0);
+        printf("burst of %d with --hook-max %d: %lu run, %lu skipped, "
+               "%lu failed\n", n, HOOK_PROCS, ttyclock->hooks.started,
+               ttyclock->hooks.skipped, ttyclock->hooks.failed);
+}
+
+/* Prints what a lap costs the main thread, per million laps taken, with
+ * the writer putting them in /dev/null, and how many of them it kept up
+ * with. */
+static void bench_laps(void) {
+        const int chunks = 5, laps = 1000000;
+        struct timespec start, end;
+        char arg[] = "+";
+        countdown_t *t;
+        int c, i;
+
+        add_timer(arg);
+        t = &ttyclock->timer[0];
+        ttyclock->lap.path = "/dev/null";
+        lap_open();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        start_timer(t, &start);
+
+        for (c = 0; c < chunks; ++c) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (i = 0; i < laps; ++i) lap_take(t);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                printf("laps %7lu-%7lu: %5.0f ns/lap, %lu dropped so far\n",
+                       t->laps - laps + 1, t->laps,
+                       (double)ts_diff_ns(&end, &start) / laps,
+                       ttyclock->lap.dropped);
+        }
+
+        lap_stop();
+}
+
+/* Starts a child that reads what the clock writes to a pseudo terminal
+ * for a second, then stops reading for 1.5 s, like a terminal that is
+ * slow or scrolled back, over and over until killed. */
+static pid_t stall_pty(int master) {
+        struct pollfd fds[1] = { { .fd = master, .events = POLLIN } };
+        struct timespec start, now;
+        pid_t pid = fork();
+
+        if (pid != 0) return pid;
+
+        for (;;) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                do {
+                        if (poll(fds, 1, 10) > 0) drain_now(master);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                } while (ts_diff_ns(&now, &start) < NSEC_PER_SEC);
+                usleep(1500000);
+        }
+}
+
+/* Runs 8 timers showing hundredths on a large terminal that keeps
+ * stalling, first drawing on the main thread and then on the render
+ * thread, and compares how late the ticks were and how many of the
+ * snapshots made it to a frame. */
+static void bench_stall(void) {
+        static const char *names[] = { "sync", "threaded" };
+        const int ntimers = 8;
+        const double secs = 6;
+        unsigned long frames, published;
+        struct timespec start, now;
+        int master, slave, phase, i;
+        char arg[16];
+        pid_t stall;
+
+        master = open_pty(60, 200, &slave);
+        /* Nothing is typed, but the main loop waits on stdin. */
+        dup2(slave, STDIN_FILENO);
+
+        ttyclock->option.frac = 2;
+        ttyclock->option.stats = True;
+        for (i = 0; i < ntimers; ++i) {
+                snprintf(arg, sizeof(arg), "1:%02d:00", i);
+                add_timer(arg);
+        }
+        init_events();
+        init_headless(slave);
+
+        for (phase = 0; phase < 2; ++phase) {
+                drain_now(master);
+                stall = stall_pty(master);
+                if (phase) render_start();
+
+                memset(&ttyclock->stats.late, 0, sizeof(hist_t));
+                frames = ttyclock->drawn.frames;
+                published = ttyclock->render.published;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                start_timers();
+
+                do {
+                        draw_timers();
+                        wait_event();
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                } while (ts_diff_ns(&now, &start) < secs * NSEC_PER_SEC);
+
+                /* The render thread may be stuck on a write until its
+                 * terminal is read again. */
+                kill(stall, SIGKILL);
+                waitpid(stall, NULL, 0);
+                stall = drain_pty(master);
+                render_stop();
+                kill(stall, SIGKILL);
+                waitpid(stall, NULL, 0);
+
+                printf("%-8s ticks: %lu, late p50: %.3f ms, p99: %.3f ms, "
+                       "max: %.3f ms, frames: %lu of %lu snapshots\n",
+                       names[phase], ttyclock->stats.late.n,
+                       hist_pct(&ttyclock->stats.late, 0.50) / 1e6,
+                       hist_pct(&ttyclock->stats.late, 0.99) / 1e6,
+                       ttyclock->stats.late.max / 1e6,
+                       ttyclock->drawn.frames - frames,
+                       ttyclock->render.published - published);
+        }
+
+        endwin();
+}
+
+/* Prints what --record adds to a frame of 8 timers showing hundredths
+ * with the ANSI backend: recording nothing, into /dev/null, and into a
+ * pipe nobody reads, where the ring fills up and frames are dropped. */
+static void bench_record(void) {
+        static const char *names[] = { "off", "/dev/null", "stuck pipe" };
+        const int ntimers = 8, frames = 20000;
+        struct timespec start, end, now;
+        int master, slave, k, i, f, p[2];
+        char arg[16], path[32];
+        long long frame_ns;
+        pid_t drain, stuck;
+        countdown_t *t;
+
+        master = open_pty(60, 200, &slave);
+        drain = drain_pty(master);
+        if (pipe(p)) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+        snprintf(path, sizeof(path), "/dev/fd/%d", p[1]);
+
+        ttyclock->option.frac = 2;
+        ttyclock->option.backend = BACKEND_ANSI;
+        ttyclock->ttyfd = slave;
+        for (i = 0; i < ntimers; ++i) {
+                snprintf(arg, sizeof(arg), "1:%02d:00", i);
+                add_timer(arg);
+        }
+
+        for (k = 0; k < 3; ++k) {
+                ansi_init();
+                if (k) {
+                        ttyclock->record.path = k == 1 ? "/dev/null" : path;
+                        record_open();
+                }
+
+                clock_now(&now);
+                for (i = 0; i < ntimers; ++i) {
+                        t = &ttyclock->timer[i];
+                        t->deadline = now;
+                        t->deadline.tv_sec += t->duration;
+                        t->dirty = True;
+                }
+                draw_timers();
+
+                frame_ns = 0;
+                for (f = 0; f < frames; ++f) {
+                        for (i = 0; i < ntimers; ++i) {
+                                t = &ttyclock->timer[i];
+                                ts_add_ns(&t->deadline, -NSEC_PER_SEC / 100);
+                                t->dirty = True;
+                        }
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_timers();
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        frame_ns += ts_diff_ns(&end, &start);
+                }
+
+                printf("%-10s %6.1f us/frame, %7.1f bytes recorded/frame, "
+                       "%lu frames dropped\n",
+                       names[k], frame_ns / 1e3 / frames,
+                       (double)atomic_load(&ttyclock->record.head) / frames,
+                       ttyclock->record.dropped);
+
+                /* The stuck writer is let go, to write out the rest. */
+                if (k == 2) stuck = drain_pty(p[0]);
+                record_stop();
+                if (k == 2) {
+                        kill(stuck, SIGTERM);
+                        waitpid(stuck, NULL, 0);
+                }
+                free(ttyclock->record.ring);
+                memset(&ttyclock->record, 0, sizeof(ttyclock->record));
+                end_screen();
+        }
+
+        kill(drain, SIGTERM);
+}
+
+/* Starts ttytimer over on a new pseudo terminal with argv, and returns
+ * the time from fork() until the label of its first frame came through,
+ * or -1 if it never did. */
+static long long launch(char *const argv[], const char *label) {
+        struct pollfd fds[1] = { { .events = POLLIN } };
+        struct timespec start, now;
+        char buf[1 << 16];
+        size_t len = 0;
+        long long ns = -1;
+        int master, slave;
+        ssize_t n;
+        pid_t pid;
+
+        master = open_pty(24, 80, &slave);
+        fds[0].fd = master;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if ((pid = fork()) == 0) {
+                setsid();
+                ioctl(slave, TIOCSCTTY, 0);
+                dup2(slave, STDIN_FILENO);
+                dup2(slave, STDOUT_FILENO);
+                dup2(slave, STDERR_FILENO);
+                close(master);
+                execv(ttytimer_path, argv);
+                _exit(EXIT_FAILURE);
+        }
+        close(slave);
+
+        while (ns < 0 && poll(fds, 1, 2000) > 0) {
+                if ((n = read(master, buf + len, sizeof(buf) - 1 - len)) <= 0)
+                        break;
+                len += n;
+                buf[len] = '\0';
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (memmem(buf, len, label, strlen(label)))
+                        ns = ts_diff_ns(&now, &start);
+                if (len == sizeof(buf) - 1) len = 0;
+        }
+
+        kill(pid, SIGTERM);
+        while (poll(fds, 1, 2000) > 0 && read(master, buf, sizeof(buf)) > 0);
+        waitpid(pid, NULL, 0);
+        close(master);
+
+        return ns;
+}
+
+/* Launches ttytimer over and over on a pseudo terminal, with either
+ * backend and 1 or 8 timers, and prints the time from fork() to the
+ * first frame. */
+static void bench_startup(void) {
+        static char *argv[][12] = {
+                { "ttytimer", "--backend", "curses", "bench=1:00:00", NULL },
+                { "ttytimer", "--backend", "ansi", "bench=1:00:00", NULL },
+                { "ttytimer", "--backend", "curses", "bench=1:00:00",
+                  "b=1:00:00", "b=1:00:00", "b=1:00:00", "b=1:00:00",
+                  "b=1:00:00", "b=1:00:00", "b=1:00:00", NULL },
+                { "ttytimer", "--backend", "ansi", "bench=1:00:00",
+                  "b=1:00:00", "b=1:00:00", "b=1:00:00", "b=1:00:00",
+                  "b=1:00:00", "b=1:00:00", "b=1:00:00", NULL },
+        };
+        const int runs = 100;
+        long long ns;
+        hist_t h;
+        int k, r;
+
+        setenv("TERM", "xterm", 1);
+
+        for (k = 0; k < 4; ++k) {
+                memset(&h, 0, sizeof(h));
+                for (r = 0; r < runs; ++r)
+                        if ((ns = launch(argv[k], "bench")) >= 0)
+                                hist_add(&h, ns);
+
+                printf("%-6s %d timer%s: first frame p50: %.2f ms, "
+                       "p99: %.2f ms, max: %.2f ms, %lu of %d runs\n",
+                       argv[k][2], k < 2 ? 1 : 8, k < 2 ? " " : "s",
+                       hist_pct(&h, 0.50) / 1e6, hist_pct(&h, 0.99) / 1e6,
+                       h.max / 1e6, h.n, runs);
+        }
+}
+
+/* Prints, per terminal size, the -z scale picked, what rasterising the
+ * glyphs at that scale costs, and time, cells and bytes per frame. */
+static void bench_scale(void) {
+        static const int sizes[][2] = { { 24, 80 }, { 60, 200 },
+                                        { 120, 400 }, { 200, 640 } };
+        const int frames = 1000, builds = 200;
+        struct timespec start, end, now;
+        long long frame_ns, build_ns;
+        unsigned long cells;
+        long bytes;
+        countdown_t *t;
+        int size, master, slave, f;
+
+        add_timer("99:00:00");
+        t = &ttyclock->timer[0];
+        ttyclock->option.fill = True;
+        setenv("TERM", "xterm", 1);
+
+        for (size = 0; size < 4; ++size) {
+                master = open_pty(sizes[size][0], sizes[size][1], &slave);
+                init_headless(slave);
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (f = 0; f < builds; ++f) build_glyphs();
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                build_ns = ts_diff_ns(&end, &start);
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                t->deadline = now;
+                t->deadline.tv_sec += t->duration;
+                t->dirty = True;
+                draw_timers();
+                drain_now(master);
+
+                frame_ns = 0;
+                bytes = 0;
+                cells = ttyclock->drawn.cells;
+                for (f = 0; f < frames; ++f) {
+                        t->deadline.tv_sec -= 1;
+                        t->dirty = True;
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_timers();
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+
+                        frame_ns += ts_diff_ns(&end, &start);
+                        bytes += drain_now(master);
+                }
+                cells = ttyclock->drawn.cells - cells;
+
+                endwin();
+                delscreen(ttyclock->ttyscr);
+                ttyclock->ttyscr = NULL;
+                close(slave);
+                close(master);
+
+                printf("{\"bench\": \"scale\", \"rows\": %d, \"cols\": %d, "
+                       "\"scale\": %d, \"build_glyphs_ns\": %.0f, "
+                       "\"frames\": %d, \"ns_per_frame\": %.0f, "
+                       "\"cells_per_frame\": %.1f, \"bytes_per_frame\": %.1f}\n",
+                       sizes[size][0], sizes[size][1], ttyclock->scale,
+                       (double)build_ns / builds, frames,
+                       (double)frame_ns / frames, (double)cells / frames,
+                       (double)bytes / frames);
+        }
+}
+
+int main(int argc, char **argv) {
+        const char *name = argc > 1 ? argv[1] : "";
+
+        if (argc > 2) ttytimer_path = argv[2];
+
+        alloc_ttyclock();
+
+        if (strcmp(name, "glyphs") == 0) bench_glyphs();
+        else if (strcmp(name, "resize") == 0) bench_resize();
+        else if (strcmp(name, "timers") == 0) bench_timers();
+        else if (strcmp(name, "backends") == 0) bench_backends();
+        else if (strcmp(name, "fraction") == 0) bench_fraction();
+        else if (strcmp(name, "ctl") == 0) bench_ctl();
+        else if (strcmp(name, "render") == 0) bench_render();
+        else if (strcmp(name, "scale") == 0) bench_scale();
+        else if (strcmp(name, "mirror") == 0) bench_mirror();
+        else if (strcmp(name, "stream") == 0) bench_stream();
+        else if (strcmp(name, "hooks") == 0) bench_hooks();
+        else if (strcmp(name, "laps") == 0) bench_laps();
+        else if (strcmp(name, "stall") == 0) bench_stall();
+        else if (strcmp(name, "record") == 0) bench_record();
+        else if (strcmp(name, "startup") == 0) bench_startup();
+        else {
+                printf("usage : %s name [ttytimer]\n"
+                       "        name   ==  glyphs | resize | timers | backends\n"
+                       "                   | fraction | ctl | render | scale\n"
+                       "                   | mirror | stream | hooks | laps\n"
+                       "                   | stall | record | startup\n"
+                       "        ttytimer   the binary startup launches,\n"
+                       "                   ./ttytimer by default\n",
+                       argv[0]);
+                exit(EXIT_FAILURE);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/*
+ * mkfont: writes fonts.h for ttytimer.
+ *
+ * The digit fonts are kept here packed, a bitmask per glyph row with
+ * the leftmost cell highest. make runs this to expand them into the
+ * rows of lit columns and the spans of them that build_glyphs() paints,
+ * so nothing is decoded cell by cell at run time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Rows of the tallest font, as MAX_GLYPHH in ttytimer.h must allow */
+#define MAXH 7
+
+typedef struct
+{
+        const char *name;
+        int cells, cellw;  /* cells in a row, and columns of each */
+        int h;
+        unsigned char mask[10][MAXH];
+} packed_t;
+
+static const packed_t packed[] =
+{
+        /* The original font, each cell 2 columns wide */
+        { "block", 3, 2, 5, {
+                { 07, 05, 05, 05, 07 }, /* 0 */
+                { 01, 01, 01, 01, 01 }, /* 1 */
+                { 07, 01, 07, 04, 07 }, /* 2 */
+                { 07, 01, 07, 01, 07 }, /* 3 */
+                { 05, 05, 07, 01, 01 }, /* 4 */
+                { 07, 04, 07, 01, 07 }, /* 5 */
+                { 07, 04, 07, 05, 07 }, /* 6 */
+                { 07, 01, 01, 01, 01 }, /* 7 */
+                { 07, 05, 07, 05, 07 }, /* 8 */
+                { 07, 05, 07, 01, 07 }, /* 9 */
+        } },
+        /* The same shapes with the sides a column wide */
+        { "thin", 6, 1, 5, {
+                { 0x3f, 0x21, 0x21, 0x21, 0x3f }, /* 0 */
+                { 0x01, 0x01, 0x01, 0x01, 0x01 }, /* 1 */
+                { 0x3f, 0x01, 0x3f, 0x20, 0x3f }, /* 2 */
+                { 0x3f, 0x01, 0x3f, 0x01, 0x3f }, /* 3 */
+                { 0x21, 0x21, 0x3f, 0x01, 0x01 }, /* 4 */
+                { 0x3f, 0x20, 0x3f, 0x01, 0x3f }, /* 5 */
+                { 0x3f, 0x20, 0x3f, 0x21, 0x3f }, /* 6 */
+                { 0x3f, 0x01, 0x01, 0x01, 0x01 }, /* 7 */
+                { 0x3f, 0x21, 0x3f, 0x21, 0x3f }, /* 8 */
+                { 0x3f, 0x21, 0x3f, 0x01, 0x3f }, /* 9 */
+        } },
+        /* Seven separate segments, the corners left out */
+        { "seven", 6, 1, 5, {
+                { 0x1e, 0x21, 0x00, 0x21, 0x1e }, /* 0 */
+                { 0x00, 0x01, 0x00, 0x01, 0x00 }, /* 1 */
+                { 0x1e, 0x01, 0x1e, 0x20, 0x1e }, /* 2 */
+                { 0x1e, 0x01, 0x1e, 0x01, 0x1e }, /* 3 */
+                { 0x00, 0x21, 0x1e, 0x01, 0x00 }, /* 4 */
+                { 0x1e, 0x20, 0x1e, 0x01, 0x1e }, /* 5 */
+                { 0x1e, 0x20, 0x1e, 0x21, 0x1e }, /* 6 */
+                { 0x1e, 0x01, 0x00, 0x01, 0x00 }, /* 7 */
+                { 0x1e, 0x21, 0x1e, 0x21, 0x1e }, /* 8 */
+                { 0x1e, 0x21, 0x1e, 0x01, 0x1e }, /* 9 */
+        } },
+        /* The classic 5x7 dot matrix, each cell 2 columns wide */
+        { "5x7", 5, 2, 7, {
+                { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, /* 0 */
+                { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e }, /* 1 */
+                { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, /* 2 */
+                { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e }, /* 3 */
+                { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, /* 4 */
+                { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e }, /* 5 */
+                { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, /* 6 */
+                { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, /* 7 */
+                { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, /* 8 */
+                { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }, /* 9 */
+        } },
+};
+
+#define NPACKED (sizeof(packed) / sizeof(packed[0]))
+
+/* Returns row mask m of font f with each cell widened to its columns. */
+static unsigned int columns(const packed_t *f, unsigned int m) {
+        unsigned int bits = 0;
+        int c, i;
+
+        for (c = f->cells - 1; c >= 0; --c)
+                for (i = 0; i < f->cellw; ++i)
+                        bits = bits << 1 | (m >> c & 1);
+
+        return bits;
+}
+
+/* Writes the spans of lit columns in bits, a glyph w columns wide, and
+ * returns how many there were. */
+static int spans(unsigned int bits, int w) {
+        int col, start, n = 0;
+
+        for (col = 0; col < w; ) {
+                if (!(bits >> (w - 1 - col) & 1)) {
+                        ++col;
+                        continue;
+                }
+
+                for (start = col; col < w && bits >> (w - 1 - col) & 1; ++col);
+                printf(" { %d, %d },", start, col - start);
+                ++n;
+        }
+
+        return n;
+}
+
+int main(void) {
+        const packed_t *f;
+        int n, row, w, first[NPACKED][10][MAXH + 1];
+        size_t i;
+
+        printf("/* Generated by mkfont from the tables in mkfont.c. */\n\n"
+               "#if MAX_GLYPHH < %d\n"
+               "#error \"MAX_GLYPHH is too small for the fonts in mkfont.c\"\n"
+               "#endif\n", MAXH);
+
+        for (i = 0; i < NPACKED; ++i) {
+                f = &packed[i];
+                w = f->cells * f->cellw;
+                if (w > 16 || f->h > MAXH) {
+                        fprintf(stderr, "mkfont: %s is too large\n", f->name);
+                        return EXIT_FAILURE;
+                }
+
+                printf("\nstatic const span_t font_span_%u[] =\n{\n",
+                       (unsigned)i);
+                for (n = 0; n < 10; ++n) {
+                        printf("        /* %d */\n", n);
+                        first[i][n][0] = n ? first[i][n - 1][f->h] : 0;
+                        for (row = 0; row < f->h; ++row) {
+                                printf("       ");
+                                first[i][n][row + 1] = first[i][n][row]
+                                        + spans(columns(f, f->mask[n][row]), w);
+                                printf("\n");
+                        }
+                }
+                printf("};\n");
+        }
+
+        printf("\nstatic const font_t fonts[] =\n{\n");
+        for (i = 0; i < NPACKED; ++i) {
+                f = &packed[i];
+                printf("        { \"%s\", %d, %d,\n          {\n",
+                       f->name, f->cells * f->cellw, f->h);
+                for (n = 0; n < 10; ++n) {
+                        printf("                {");
+                        for (row = 0; row < f->h; ++row)
+                                printf(" 0x%03x,", columns(f, f->mask[n][row]));
+                        printf(" },\n");
+                }
+                printf("          },\n          font_span_%u,\n          {\n",
+                       (unsigned)i);
+                for (n = 0; n < 10; ++n) {
+                        printf("                {");
+                        for (row = 0; row <= f->h; ++row)
+                                printf(" %d,", first[i][n][row]);
+                        printf(" },\n");
+                }
+                printf("          } },\n");
+        }
+        printf("};\n\n#define N_FONTS %u\n", (unsigned)NPACKED);
+
+        return EXIT_SUCCESS;
+}
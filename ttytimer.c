@@ -29,7 +29,9 @@
  *      OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <sys/resource.h>
 
 #ifdef TOOT
 #include <toot.h>
@@ -37,103 +39,459 @@
 
 #include "ttytimer.h"
 
-static bool time_is_zero(void) {
-        return ttyclock->date.hour[0] == 0
-               && ttyclock->date.hour[1] == 0
-               && ttyclock->date.minute[0] == 0
-               && ttyclock->date.minute[1] == 0
-               && ttyclock->date.second[0] == 0
-               && ttyclock->date.second[1] == 0;
+ttyclock_t *ttyclock;
+
+static bool time_is_zero(const date_t *date) {
+        return date->hour[0] == 0
+               && date->hour[1] == 0
+               && date->minute[0] == 0
+               && date->minute[1] == 0
+               && date->second[0] == 0
+               && date->second[1] == 0
+               && date->frac[0] == 0
+               && date->frac[1] == 0;
+}
+
+/* Maps a frame column or row laid out for the unscaled font to the
+ * current scale. The border stays one cell wide. */
+static int scaled(int pos) {
+        return 1 + (pos - 1) * ttyclock->scale;
+}
+
+/* Returns the unscaled frame column of digit pos: the pairs of hh:mm:ss
+ * with a column between the digits and 6 for the colon between pairs,
+ * then past a point the fractions of a second. */
+int digit_col(int pos) {
+        int w = ttyclock->option.font->w;
+
+        if (pos >= N_TIME_DIGITS)
+                return digit_col(N_TIME_DIGITS - 1) + w + 4
+                       + (pos - N_TIME_DIGITS) * (w + 1);
+
+        return 1 + pos * (w + 1) + pos / 2 * 5;
+}
+
+/* Returns the width of t's clock frame, with room for -f's digits, or
+ * without the seconds while t is coarse. NULL gives the widest frame.
+ * A column is left between the last digit and the border. */
+static int frame_width(const countdown_t *t) {
+        int last = N_TIME_DIGITS - 1 + ttyclock->option.frac;
+
+        if (t && t->shown.coarse) last = 3;
+
+        return scaled(digit_col(last) + ttyclock->option.font->w + 1) + 1;
+}
+
+/* Returns the height of a clock frame. */
+static int frame_height(void) {
+        return scaled(ttyclock->option.font->h + 1) + 1;
+}
+
+/* The real clock: CLOCK_MONOTONIC. */
+static void monotonic_now(struct timespec *now) {
+        clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+/* The virtual clock of --soak: it stands still until moved. */
+static void virtual_now(struct timespec *now) {
+        *now = ttyclock->vnow;
+}
+
+/* Reads the clock every deadline, tick and blink is timed against. */
+void clock_now(struct timespec *now) {
+        ttyclock->clock(now);
+}
+
+/* Returns a - b in nanoseconds. */
+long long ts_diff_ns(const struct timespec *a, const struct timespec *b) {
+        return (a->tv_sec - b->tv_sec) * NSEC_PER_SEC
+               + (a->tv_nsec - b->tv_nsec);
+}
+
+/* Adds ns nanoseconds to ts. */
+void ts_add_ns(struct timespec *ts, long long ns) {
+        ns += ts->tv_nsec;
+        ts->tv_sec += ns / NSEC_PER_SEC;
+        ts->tv_nsec = ns % NSEC_PER_SEC;
+        if (ts->tv_nsec < 0) {
+                ts->tv_nsec += NSEC_PER_SEC;
+                --ts->tv_sec;
+        }
+}
+
+/* Wakes the thread waiting on eventfd fd in efd_wait(). */
+static void efd_wake(int fd) {
+        uint64_t one = 1;
+
+        if (write(fd, &one, sizeof(one)) < 0) return;
+}
+
+/* Waits up to ms milliseconds (forever if -1) for eventfd fd to be
+ * woken, and returns whether it was. */
+static Bool efd_wait(int fd, int ms) {
+        struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+        uint64_t n;
+
+        return poll(fds, 1, ms) > 0 && read(fd, &n, sizeof(n)) == sizeof(n);
+}
+
+/* Returns the histogram bucket of v. Values below HIST_SUB get a bucket
+ * each, larger ones share HIST_SUB buckets per power of two. */
+static int hist_bucket(long long v) {
+        int e;
+
+        if (v < HIST_SUB) return v < 0 ? 0 : v;
+
+        e = 63 - __builtin_clzll(v);
+        return (e - 2) * HIST_SUB + ((v >> (e - 3)) & (HIST_SUB - 1));
+}
+
+/* Returns the smallest value that falls in bucket b. */
+static long long hist_value(int b) {
+        if (b < HIST_SUB) return b;
+
+        return (long long)(HIST_SUB + b % HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+/* Counts v in h. */
+void hist_add(hist_t *h, long long v) {
+        ++h->count[hist_bucket(v)];
+        ++h->n;
+        if (v > h->max) h->max = v;
+}
+
+/* Returns the value below which a fraction p of h's values fall, to the
+ * width of a bucket. */
+long long hist_pct(const hist_t *h, double p) {
+        unsigned long want = p * h->n, seen = 0;
+        long long v;
+        int b;
+
+        for (b = 0; b < HIST_BUCKETS; ++b) {
+                seen += h->count[b];
+                if (seen > want || seen == h->n) break;
+        }
+
+        v = hist_value(b + 1) - 1;
+        return v < h->max ? v : h->max;
+}
+
+/* Returns the bytes written to the terminal so far. ncurses writes to it
+ * behind our back, so with it this is every byte written by the thread
+ * that draws, which writes nothing else: the stream, the laps, the
+ * recording and the control socket are all written by other threads. */
+static unsigned long tty_bytes(void) {
+        char buf[512], *p;
+        ssize_t n;
+
+        if (ttyclock->option.backend == BACKEND_ANSI) return ttyclock->ansi.bytes;
+
+        if (ttyclock->stats.iofd <= 0
+            || (n = pread(ttyclock->stats.iofd, buf, sizeof(buf) - 1, 0)) <= 0)
+                return 0;
+
+        buf[n] = '\0';
+        p = strstr(buf, "wchar:");
+        return p ? strtoul(p + 6, NULL, 10) : 0;
+}
+
+/* Prints one line of the --stats report, in units of scale. */
+static void stats_line(FILE *f, const char *name, const hist_t *h,
+                       double scale) {
+        fprintf(f, "%-16s %8lu %10.1f %10.1f %10.1f\n", name, h->n,
+                hist_pct(h, 0.50) / scale, hist_pct(h, 0.99) / scale,
+                h->max / scale);
+}
+
+/* Returns n events over ns as a rate per hour. */
+static double per_hour(unsigned long n, long long ns) {
+        return ns > 0 ? n * 3600e9 / ns : 0.0;
+}
+
+/* Ends startup phase p, if it is the one due, timing it from the end of
+ * the one before. */
+static void startup_mark(StartPhase p) {
+        struct timespec now;
+
+        if (ttyclock->stats.phase != p) return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ttyclock->stats.startup[p] = ts_diff_ns(&now, &ttyclock->stats.mark);
+        ttyclock->stats.mark = now;
+        ttyclock->stats.phase = p + 1;
+}
+
+/* Copies the main thread's --stats figures to m. */
+static void stats_take(stats_main_t *m) {
+        clock_gettime(CLOCK_MONOTONIC, &m->at);
+        m->wakeups = ttyclock->stats.wakeups;
+        memcpy(m->mode_wakeups, ttyclock->stats.mode_wakeups,
+               sizeof(m->mode_wakeups));
+        memcpy(m->mode_ns, ttyclock->stats.mode_ns, sizeof(m->mode_ns));
+        m->published = ttyclock->render.published;
+        m->hooks_started = ttyclock->hooks.started;
+        m->hooks_skipped = ttyclock->hooks.skipped;
+        m->hooks_failed = ttyclock->hooks.failed;
+        m->hooks_running = ttyclock->hooks.running;
+        m->laps = ttyclock->lap.head;
+        m->laps_dropped = ttyclock->lap.dropped;
+        m->keys = ttyclock->stats.keys;
+        m->late = ttyclock->stats.late;
+        m->spawn = ttyclock->stats.spawn;
+}
+
+/* Writes a summary of the --stats histograms to their file or stderr,
+ * with the main thread's figures from m and the drawing's as they are. */
+static void stats_report(const stats_main_t *m) {
+        double secs;
+        FILE *f = stderr;
+
+        if (ttyclock->stats.path && !(f = fopen(ttyclock->stats.path, "a"))) {
+                perror(ttyclock->stats.path);
+                return;
+        }
+
+        secs = ts_diff_ns(&m->at, &ttyclock->stats.start) / 1e9;
+
+        fprintf(f, "stats: %.1f s, %lu wakeups (%.1f/min), %lu refreshes, "
+                "%lu bytes\n",
+                secs, m->wakeups, secs > 0 ? m->wakeups * 60 / secs : 0.0,
+                ttyclock->stats.refreshes,
+                ttyclock->stats.written);
+        if (ttyclock->option.backend == BACKEND_STREAM)
+                fprintf(f, "stream: %llu records, %llu dropped\n",
+                        (unsigned long long)ttyclock->stream.seq,
+                        (unsigned long long)ttyclock->stream.dropped);
+        if (ttyclock->hooks.n)
+                fprintf(f, "hooks: %lu run, %lu skipped, %lu failed, "
+                        "%d still running\n",
+                        m->hooks_started, m->hooks_skipped,
+                        m->hooks_failed, m->hooks_running);
+        if (ttyclock->lap.ring)
+                fprintf(f, "laps: %llu taken, %lu dropped\n",
+                        (unsigned long long)m->laps + m->laps_dropped,
+                        m->laps_dropped);
+        if (ttyclock->stats.phase == START_PHASES)
+                fprintf(f, "startup: %.0f us to the first frame: args %.0f, "
+                        "setup %.0f, screen %.0f, timers %.0f, frame %.0f\n",
+                        (ttyclock->stats.startup[START_ARGS]
+                         + ttyclock->stats.startup[START_SETUP]
+                         + ttyclock->stats.startup[START_SCREEN]
+                         + ttyclock->stats.startup[START_TIMERS]
+                         + ttyclock->stats.startup[START_FRAME]) / 1e3,
+                        ttyclock->stats.startup[START_ARGS] / 1e3,
+                        ttyclock->stats.startup[START_SETUP] / 1e3,
+                        ttyclock->stats.startup[START_SCREEN] / 1e3,
+                        ttyclock->stats.startup[START_TIMERS] / 1e3,
+                        ttyclock->stats.startup[START_FRAME] / 1e3);
+        if (m->published)
+                fprintf(f, "render: %lu snapshots published, %lu frames\n",
+                        m->published, ttyclock->drawn.frames);
+        if (ttyclock->record.ring)
+                fprintf(f, "record: %lu frames, %llu bytes, %lu dropped\n",
+                        ttyclock->record.frames,
+                        (unsigned long long)ttyclock->record.head,
+                        ttyclock->record.dropped);
+        if (ttyclock->option.powersave)
+                fprintf(f, "powersave: %.1f wakeups/h over %.1f s waiting "
+                        "for minutes, %.1f/h over %.1f s for seconds\n",
+                        per_hour(m->mode_wakeups[1], m->mode_ns[1]),
+                        m->mode_ns[1] / 1e9,
+                        per_hour(m->mode_wakeups[0], m->mode_ns[0]),
+                        m->mode_ns[0] / 1e9);
+        fprintf(f, "%-16s %8s %10s %10s %10s\n", "", "n", "p50", "p99", "max");
+        stats_line(f, "draw_clock (us)", &ttyclock->stats.draw, 1e3);
+        stats_line(f, "key_event (us)", &m->keys, 1e3);
+        stats_line(f, "lateness (us)", &m->late, 1e3);
+        stats_line(f, "bytes/frame", &ttyclock->stats.tty, 1);
+        stats_line(f, "refreshes/frame", &ttyclock->stats.refresh, 1);
+        if (ttyclock->hooks.n)
+                stats_line(f, "hook spawn (us)", &m->spawn, 1e3);
+
+        if (f != stderr) fclose(f);
 }
 
 /* Prints usage message and exits with exit code exit_code. */
 static void usage(char *argv0, int exit_code) {
-        printf("usage : %s [-xbvih] [-C color] hh:mm:ss\n"
+        printf("usage : %s [-xbzDvih] [-C color] [-f digits] [-a pattern] [label=]hh:mm:ss ...\n"
+               "        %s [options] --program file [[label=]hh:mm:ss ...]\n"
+               "        %s [options] --state file --resume\n"
+               "        %s --ctl path [command]\n"
+               "        %s --replay file [--speed x]\n"
+               "        [label=]+     Count up from zero instead, as a stopwatch\n"
+               "                      that takes a lap on l\n"
                "        -x            Show box\n"
                "        -C color      Set the clock color\n"
                "           color  ==  black | red | green\n"
                "                      | yellow | blue | magenta\n"
                "                      | cyan | white\n"
                "        -b            Use bold colors\n"
+               "        -f digits     Show tenths (1) or hundredths (2) of seconds\n"
+               "        -z            Scale the digits up to fill the terminal\n"
+               "        --font name   Draw the digits in font name\n"
+               "           name   ==  block | thin | seven | 5x7\n"
+               "        --powersave   Show and wake for minutes only, until the\n"
+               "                      last one\n"
+               "        --mirror tty  Show the same frames on terminal tty too;\n"
+               "                      may be given up to 8 times\n"
+               "        --stream[=f]  Write a JSON line per tick to file or FIFO f,\n"
+               "                      or stdout, instead of drawing\n"
+               "        --binary      Write --stream records as 32-byte structs\n"
+               "        --program f   Count down the [label=]hh:mm:ss lines of\n"
+               "                      file f, or stdin for -, one after another\n"
+               "        --hook [hh:mm:ss=]cmd\n"
+               "                      Run cmd when a timer gets to zero, or to\n"
+               "                      hh:mm:ss left; may be given up to 16 times\n"
+               "        --hook-max n  Run at most n hooks at once, 4 by default\n"
+               "        --laps file   Append each lap of a stopwatch to file\n"
+               "        --record f    Record the frames to file f as asciicast v2,\n"
+               "                      drawn with the ansi backend\n"
+               "        --replay f    Play recording f back on the terminal\n"
+               "        --speed x     Replay x times as fast, or at once for 0\n"
+               "        -a pattern    Alarm tones as hz:ms,... (hz 0 for a pause),\n"
+               "                      then /n to play them n times only\n"
+               "        --alarm kind  Sound the alarm with toot, the terminal\n"
+               "                      bell or a flash of the screen, or not at all\n"
+               "           kind   ==  toot | bell | flash | off\n"
+               "        -D            Print tick drift and redraw stats on exit\n"
                "        -v            Show ttytimer version\n"
-               "        -h            Show this page\n", argv0);
+               "        -h            Show this page\n"
+               "        --state file  Keep the timers in file, to pick them up\n"
+               "                      with --resume after a restart\n"
+               "        --resume      Resume the timers kept in the --state file\n"
+               "        --socket path Take commands on a control socket at path\n"
+               "        --ctl path    Send the command in the other arguments,\n"
+               "                      status by default, to a control socket\n"
+               "        --stats[=f]   Report draw, key, tick and output costs on exit,\n"
+               "                      to file f or stderr\n"
+               "        --backend b   Draw with ncurses or raw escape sequences\n"
+               "           b      ==  curses | ansi\n"
+               "        --soak        Count the timers down on a virtual clock, as\n"
+               "                      fast as they can be drawn, checking each value\n",
+               argv0, argv0, argv0, argv0, argv0);
         exit(exit_code);
 }
 
+/* Creates the windows of timer t. */
+static void init_timer(countdown_t *t) {
+        t->geo.w = frame_width(t);
+        t->geo.h = frame_height();
+
+        /* Create clock win */
+        t->framewin = newwin(t->geo.h, t->geo.w, t->geo.x, t->geo.y);
+        if (ttyclock->option.box) box(t->framewin, 0, 0);
+
+        if (ttyclock->option.bold) wattron(t->framewin, A_BLINK);
+
+        /* Create the date win */
+        t->datewin = newwin(DATEWINH, strlen(t->shown.date.timestr) + 2,
+                            t->geo.x + t->geo.h - 1,
+                            t->geo.y + (t->geo.w / 2) -
+                            (strlen(t->shown.date.timestr) / 2) - 1);
+
+        if (ttyclock->option.box) box(t->datewin, 0, 0);
+
+        clearok(t->datewin, True);
+}
+
+/* Sets up the color pairs of the current screen. */
+static void init_pairs(void) {
+        init_pair(0, ttyclock->bg, ttyclock->bg);
+        init_pair(1, ttyclock->bg, ttyclock->option.color);
+        init_pair(2, ttyclock->option.color, ttyclock->bg);
+}
+
 void init(void) {
-        struct sigaction sig;
+        int i;
+
         ttyclock->bg = COLOR_BLACK;
 
-        initscr();
+        /* A screen may already be set up on another terminal. Mirrors
+         * switch between screens, so this one is kept at hand too. */
+        if (!ttyclock->ttyscr) {
+                ttyclock->ttyscr = newterm(NULL, stdout, stdin);
+                if (!ttyclock->ttyscr) {
+                        fputs("Cannot set up the terminal\n", stderr);
+                        exit(EXIT_FAILURE);
+                }
+        }
 
         cbreak();
         noecho();
         keypad(stdscr, True);
+        /* Keys are read() by the main thread (see read_key()), so
+         * ncurses mustn't look for them while drawing. */
+        typeahead(-1);
         start_color();
         curs_set(False);
-        clear();
+        /* Cleared with the first frame, in the same write. */
+        clearok(curscr, True);
 
         /* Init default terminal color */
         if (use_default_colors() == OK) ttyclock->bg = -1;
 
-        /* Init color pair */
-        init_pair(0, ttyclock->bg, ttyclock->bg);
-        init_pair(1, ttyclock->bg, ttyclock->option.color);
-        init_pair(2, ttyclock->option.color, ttyclock->bg);
-        refresh();
+        init_pairs();
 
-        /* Init signal handler */
-        sig.sa_handler = signal_handler;
-        sig.sa_flags   = 0;
-        sigaction(SIGWINCH, &sig, NULL);
-        sigaction(SIGTERM,  &sig, NULL);
-        sigaction(SIGINT,   &sig, NULL);
-        sigaction(SIGSEGV,  &sig, NULL);
+        build_glyphs();
 
         /* Init global struct */
         ttyclock->running = True;
-        if(!ttyclock->geo.x) ttyclock->geo.x = 0;
-        if(!ttyclock->geo.y) ttyclock->geo.y = 0;
-        if(!ttyclock->geo.a) ttyclock->geo.a = 1;
-        if(!ttyclock->geo.b) ttyclock->geo.b = 1;
-        ttyclock->geo.w = SECFRAMEW;
-        ttyclock->geo.h = 7;
         ttyclock->tm = localtime(&(ttyclock->lt));
         ttyclock->lt = time(NULL);
 
-        /* Create clock win */
-        ttyclock->framewin = newwin(ttyclock->geo.h,
-                                    ttyclock->geo.w,
-                                    ttyclock->geo.x,
-                                    ttyclock->geo.y);
-        if (ttyclock->option.box) box(ttyclock->framewin, 0, 0);
-
-        if (ttyclock->option.bold) wattron(ttyclock->framewin, A_BLINK);
-
-        /* Create the date win */
-        ttyclock->datewin = newwin(DATEWINH, strlen(ttyclock->date.timestr) + 2,
-                                   ttyclock->geo.x + ttyclock->geo.h - 1,
-                                   ttyclock->geo.y + (ttyclock->geo.w / 2) -
-                                   (strlen(ttyclock->date.timestr) / 2) - 1);
-
-        if (ttyclock->option.box) box(ttyclock->datewin, 0, 0);
-
-        clearok(ttyclock->datewin, True);
+        /* The windows are made where set_center() puts them. */
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                ttyclock->timer[i].framewin = NULL;
+                memcpy(&ttyclock->timer[i].shown.date,
+                       &ttyclock->timer[i].date, sizeof(date_t));
+        }
 
         set_center();
 
         nodelay(stdscr, True);
+}
+
+/* Sets up the event sources for wait_event(). Must run before init(), so
+ * the signals are already blocked when ncurses starts. */
+void init_events(void) {
+        struct sigaction sig;
+        sigset_t mask;
+
+        /* Signals handled in the main loop are read from a signalfd. */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGWINCH);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGUSR1);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
 
-        wrefresh(ttyclock->datewin);
+        ttyclock->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        ttyclock->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                           TFD_NONBLOCK | TFD_CLOEXEC);
+        if (ttyclock->sigfd == -1 || ttyclock->timerfd == -1) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
 
-        wrefresh(ttyclock->framewin);
+        /* A segfault can't wait for the main loop. */
+        memset(&sig, 0, sizeof(sig));
+        sig.sa_handler = signal_handler;
+        sigaction(SIGSEGV, &sig, NULL);
 }
 
 void signal_handler(int signal) {
         switch(signal) {
         case SIGWINCH:
-                endwin();
-                init();
+                /* Handled once the pending signals are drained. */
+                ttyclock->resize = True;
+                break;
+        case SIGUSR1:
+                ttyclock->stats.dump = True;
+                break;
+        case SIGCHLD:
+                /* A --hook exited, reaped with the others pending. */
+                ttyclock->hooks.reap = True;
                 break;
                 /* Interruption signal */
         case SIGINT:
@@ -142,355 +500,3818 @@ void signal_handler(int signal) {
                 /* Segmentation fault signal */
                 break;
         case SIGSEGV:
-                endwin();
+                end_screen();
                 fprintf(stderr, "Segmentation fault.\n");
                 exit(EXIT_FAILURE);
                 break;
         }
 }
 
-void cleanup(void) {
-        if (ttyclock->ttyscr) delscreen(ttyclock->ttyscr);
-        if (ttyclock) free(ttyclock);
-}
+/* Follows a terminal size change, moving the existing windows. */
+void resize_clock(void) {
+        struct winsize ws;
+
+        if (ttyclock->option.backend == BACKEND_STREAM) return;
 
-/* Decrements ttyclock's time by 1 second. */
-void update_hour(void) {
-        unsigned int seconds = ttyclock->date.second[0] * 10
-                               + ttyclock->date.second[1];
-        unsigned int minutes = ttyclock->date.minute[0] * 10
-                               + ttyclock->date.minute[1];
-        unsigned int hours = ttyclock->date.hour[0] * 10
-                             + ttyclock->date.hour[1];
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_resize();
+        } else if (ioctl(ttyclock->ttyfd, TIOCGWINSZ, &ws) == 0
+                   && ws.ws_row > 0 && ws.ws_col > 0) {
+                resizeterm(ws.ws_row, ws.ws_col);
+        }
 
-        if (minutes == 0 && seconds == 0) hours = hours == 0 ? 59 : hours - 1;
-        if (seconds == 0) minutes = minutes == 0 ? 59 : minutes - 1;
-        seconds = seconds == 0 ? 59 : seconds - 1;
+        set_center();
+}
 
-        /* Put it all back into ttyclock. */
-        ttyclock->date.hour[0] = hours / 10;
-        ttyclock->date.hour[1] = hours % 10;
+/* Gives back the terminal, whichever backend drew on it. */
+void end_screen(void) {
+        int i;
 
-        ttyclock->date.minute[0] = minutes / 10;
-        ttyclock->date.minute[1] = minutes % 10;
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_end();
+                return;
+        }
+        if (ttyclock->option.backend == BACKEND_STREAM) {
+                stream_end();
+                return;
+        }
 
-        ttyclock->date.second[0] = seconds / 10;
-        ttyclock->date.second[1] = seconds % 10;
+        for (i = 0; i < ttyclock->mirror.n; ++i) {
+                set_term(ttyclock->mirror.term[i].scr);
+                endwin();
+        }
+        set_term(ttyclock->ttyscr);
+        endwin();
 }
 
-void draw_number(int n, int x, int y, unsigned int color) {
-        int i, sy = y;
-
-        for(i = 0; i < 30; ++i, ++sy) {
-                if(sy == y + 6) {
-                        sy = y;
-                        ++x;
-                }
+/* Returns the size of the terminal the clock is drawn on. */
+static void screen_size(int *lines, int *cols) {
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                *lines = ttyclock->ansi.rows;
+                *cols = ttyclock->ansi.cols;
+        } else {
+                *lines = LINES;
+                *cols = COLS;
+        }
+}
 
-                if (ttyclock->option.bold) wattron(ttyclock->framewin, A_BLINK);
-                else wattroff(ttyclock->framewin, A_BLINK);
+void cleanup(void) {
+        int i;
 
-                wbkgdset(ttyclock->framewin,
-                         COLOR_PAIR(number[n][i/2] * color));
-                mvwaddch(ttyclock->framewin, x, sy, ' ');
+        if (ttyclock->ttyscr) delscreen(ttyclock->ttyscr);
+        if (ttyclock) {
+                for (i = 0; i < ttyclock->mirror.n; ++i)
+                        if (ttyclock->mirror.term[i].scr)
+                                delscreen(ttyclock->mirror.term[i].scr);
+                free(ttyclock->timer);
+                free(ttyclock->heap);
+                free(ttyclock->glyph);
+                free(ttyclock->render.timer);
+                free(ttyclock->render.read);
+                free(ttyclock->lap.ring);
+                free(ttyclock->record.ring);
+                free(ttyclock->ansi.front);
+                free(ttyclock->ansi.back);
+                free(ttyclock->ansi.dirty);
+                free(ttyclock->ansi.out);
+                if (ttyclock->state.file)
+                        munmap(ttyclock->state.file, ttyclock->state.size);
+                if (ttyclock->ctl.fd > 0) unlink(ttyclock->ctl.path);
+                free(ttyclock);
         }
+}
 
-        wrefresh(ttyclock->framewin);
+/* Tick heap: the running timers ordered by their next tick, so one
+ * timerfd wakeup serves every timer that ticks at that instant. */
+
+static Bool tick_before(countdown_t *a, countdown_t *b) {
+        return ts_diff_ns(&a->next_tick, &b->next_tick) < 0;
 }
 
-void draw_clock(void) {
-        chtype dotcolor = COLOR_PAIR(1);
-        unsigned int numcolor = 1;
+static void heap_set(int i, countdown_t *t) {
+        ttyclock->heap[i] = t;
+        t->heap_index = i;
+}
 
-        /* Change the colours to blink at certain times. */
-        if (time(NULL) % 2 == 0) {
-                dotcolor = COLOR_PAIR(2);
-                if (time_is_zero()) numcolor = 2;
+static void heap_up(int i) {
+        countdown_t *t = ttyclock->heap[i];
+
+        while (i > 0 && tick_before(t, ttyclock->heap[(i - 1) / 2])) {
+                heap_set(i, ttyclock->heap[(i - 1) / 2]);
+                i = (i - 1) / 2;
         }
+        heap_set(i, t);
+}
 
-        /* Draw hour numbers */
-        draw_number(ttyclock->date.hour[0], 1, 1, numcolor);
-        draw_number(ttyclock->date.hour[1], 1, 8, numcolor);
+static void heap_down(int i) {
+        countdown_t *t = ttyclock->heap[i];
+        int child;
 
-        /* 2 dot for number separation */
-        wbkgdset(ttyclock->framewin, dotcolor);
-        mvwaddstr(ttyclock->framewin, 2, 16, "  ");
-        mvwaddstr(ttyclock->framewin, 4, 16, "  ");
+        while ((child = 2 * i + 1) < ttyclock->heapn) {
+                if (child + 1 < ttyclock->heapn
+                    && tick_before(ttyclock->heap[child + 1],
+                                   ttyclock->heap[child]))
+                        ++child;
+                if (!tick_before(ttyclock->heap[child], t)) break;
+                heap_set(i, ttyclock->heap[child]);
+                i = child;
+        }
+        heap_set(i, t);
+}
 
-        /* Draw minute numbers */
-        draw_number(ttyclock->date.minute[0], 1, 20, numcolor);
-        draw_number(ttyclock->date.minute[1], 1, 27, numcolor);
+static void heap_remove(countdown_t *t) {
+        int i = t->heap_index;
+        countdown_t *last;
 
-        /* Draw the date */
-        if (ttyclock->option.bold) wattron(ttyclock->datewin, A_BOLD);
-        else wattroff(ttyclock->datewin, A_BOLD);
+        if (i < 0) return;
 
-        wbkgdset(ttyclock->datewin, (COLOR_PAIR(2)));
-        mvwprintw(ttyclock->datewin, (DATEWINH / 2), 1, ttyclock->date.timestr);
-        wrefresh(ttyclock->datewin);
+        t->heap_index = -1;
+        last = ttyclock->heap[--ttyclock->heapn];
+        if (last == t) return;
 
-        /* Draw second frame. */
-        /* Again 2 dot for number separation */
-        wbkgdset(ttyclock->framewin, dotcolor);
-        mvwaddstr(ttyclock->framewin, 2, NORMFRAMEW, "  ");
-        mvwaddstr(ttyclock->framewin, 4, NORMFRAMEW, "  ");
+        heap_set(i, last);
+        heap_up(i);
+        heap_down(last->heap_index);
+}
 
-        /* Draw second numbers */
-        draw_number(ttyclock->date.second[0], 1, 39, numcolor);
-        draw_number(ttyclock->date.second[1], 1, 46, numcolor);
+/* (Re)schedules t's ticks after its next_tick changed. */
+static void heap_update(countdown_t *t) {
+        if (t->heap_index < 0) {
+                t->heap_index = ttyclock->heapn++;
+                ttyclock->heap[t->heap_index] = t;
+        }
+        heap_up(t->heap_index);
+        heap_down(t->heap_index);
 }
 
-void clock_move(int x, int y, int w, int h) {
-        /* Erase border for a clean move */
-        wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
-        wborder(ttyclock->framewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
-        werase(ttyclock->framewin);
-        wrefresh(ttyclock->framewin);
+/* Arms the tick timer for the earliest tick of any running timer. */
+void arm_tick(void) {
+        struct itimerspec its;
+
+        /* Left disarmed for a coarse tick, which wait_event() times. */
+        memset(&its, 0, sizeof(its));
+        if (ttyclock->heapn > 0 && !ttyclock->heap[0]->coarse)
+                its.it_value = ttyclock->heap[0]->next_tick;
 
-        wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
-        wborder(ttyclock->datewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
-        werase(ttyclock->datewin);
-        wrefresh(ttyclock->datewin);
+        timerfd_settime(ttyclock->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
 
-        /* Frame win move */
-        mvwin(ttyclock->framewin, (ttyclock->geo.x = x), (ttyclock->geo.y = y));
-        wresize(ttyclock->framewin, (ttyclock->geo.h = h),
-                (ttyclock->geo.w = w));
+/* Returns the time the last digit shown stands for, in nanoseconds. */
+static long long frac_unit(void) {
+        long long unit = NSEC_PER_SEC;
+        int i;
 
-        /* Date win move */
-        mvwin(ttyclock->datewin,
-              ttyclock->geo.x + ttyclock->geo.h - 1,
-              ttyclock->geo.y + (ttyclock->geo.w / 2)
-              - (strlen(ttyclock->date.timestr) / 2) - 1);
-        wresize(ttyclock->datewin, DATEWINH,
-                strlen(ttyclock->date.timestr) + 2);
+        for (i = 0; i < ttyclock->option.frac; ++i) unit /= 10;
+
+        return unit;
+}
 
-        if (ttyclock->option.box) box(ttyclock->datewin,  0, 0);
+/* Marks the --hook commands whose time left t has come down to as due,
+ * and arms those it is above again, e.g. after a reset: a hook runs
+ * once each time t passes its threshold. Returns the time until the
+ * next armed threshold, LLONG_MAX if there is none. */
+static long long hook_check(countdown_t *t, long long left) {
+        long long until = LLONG_MAX, at;
+        unsigned int bit;
+        int i;
 
-        if (ttyclock->option.box) box(ttyclock->framewin, 0, 0);
+        for (i = 0; i < ttyclock->hooks.n; ++i) {
+                at = ttyclock->hooks.hook[i].at;
+                bit = 1u << i;
+                if (left > at) {
+                        t->hooks_armed |= bit;
+                        if (left - at < until) until = left - at;
+                } else if (t->hooks_armed & bit) {
+                        t->hooks_armed &= ~bit;
+                        t->hooks_due |= bit;
+                        ttyclock->hooks.due = True;
+                }
+        }
 
-        wrefresh(ttyclock->framewin);
-        wrefresh(ttyclock->datewin); 
+        return until;
 }
 
-void set_second(void) {
-        int new_w = SECFRAMEW;
-        int y_adj;
+/* Sets t's next tick, the first after now that falls on a whole number
+ * of periods before the deadline. The period is that of the last digit
+ * while fractions of a second show, and a second while they don't: on
+ * a hidden tile, or once the deadline has passed. */
+static void schedule_tick(countdown_t *t, const struct timespec *now) {
+        long long left = ts_diff_ns(&t->deadline, now);
+        long long period = NSEC_PER_SEC, rest, until = hook_check(t, left);
 
-        for(y_adj = 0; (ttyclock->geo.y - y_adj) > (COLS - new_w - 1); ++y_adj);
+        /* Minutes rounded up stay under 100 hours, see add_timer(). */
+        t->coarse = ttyclock->option.powersave && left > COARSE_NS
+                    && left <= 100 * 3600 * NSEC_PER_SEC - COARSE_NS;
+        if (t->coarse) period = COARSE_NS;
+        else if ((left > 0 || t->up) && !t->hidden) period = frac_unit();
 
-        clock_move(ttyclock->geo.x, (ttyclock->geo.y - y_adj), new_w,
-                   ttyclock->geo.h);
+        rest = (left % period + period) % period;
+        if (!rest) rest = period;
 
-        set_center();
+        /* A hook threshold between ticks, as within a --powersave
+         * minute, gets a tick of its own. */
+        t->next_tick = *now;
+        ts_add_ns(&t->next_tick, until < rest ? until : rest);
 }
 
-void set_center(void) {
-        clock_move((LINES / 2 - (ttyclock->geo.h / 2)),
-                   (COLS  / 2 - (ttyclock->geo.w / 2)),
-                   ttyclock->geo.w,
-                   ttyclock->geo.h);
+/* Starts stopwatch t over from lap 0. */
+static void lap_reset(countdown_t *t) {
+        t->laps = t->lap_shown = 0;
+        t->lap_ns = 0;
+        t->date.timestr[t->labellen] = '\0';
 }
 
-void set_box(Bool b) {
-        ttyclock->option.box = b;
+/* (Re)starts countdown t at now: the deadline is fixed once, and ticks
+ * fall on whole periods before it (see schedule_tick()). Timers started
+ * at the same now tick together. The caller has to arm_tick(). */
+void start_timer(countdown_t *t, const struct timespec *now) {
+        t->deadline = *now;
+        t->deadline.tv_sec += t->duration;
+        if (t->up) lap_reset(t);
+
+        schedule_tick(t, now);
+
+        t->paused = False;
+        t->dirty = True;
+        heap_update(t);
+        state_save(t);
+}
+
+/* Pauses or resumes countdown t. */
+void pause_timer(countdown_t *t) {
+        struct timespec now;
 
-        wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
-        wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
+        clock_now(&now);
 
-        if(ttyclock->option.box) {
-                wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
-                wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
-                box(ttyclock->framewin, 0, 0);
-                box(ttyclock->datewin,  0, 0);
+        if (!t->paused) {
+                t->left_ns = ts_diff_ns(&t->deadline, &now);
+                if (t->left_ns < 0 && !t->up) t->left_ns = 0;
+                t->paused = True;
+                t->coarse = False;
+                heap_remove(t);
         } else {
-                wborder(ttyclock->framewin, ' ', ' ', ' ', ' ', ' ', ' ',
-                        ' ', ' ');
-                wborder(ttyclock->datewin, ' ', ' ', ' ', ' ', ' ', ' ',
-                        ' ', ' ');
+                t->deadline = now;
+                ts_add_ns(&t->deadline, t->left_ns);
+                schedule_tick(t, &now);
+
+                t->paused = False;
+                heap_update(t);
         }
 
-        wrefresh(ttyclock->datewin);
-        wrefresh(ttyclock->framewin);
+        t->dirty = True;
+        state_save(t);
+        arm_tick();
 }
 
-/* Fills two elements from digits into time, handling the -1 case. */
-static void fill_ttyclock_time(int *digits, unsigned int *time) {
-        if (digits[1] == -1) {
-                time[0] = 0;
-                if (digits[0] == -1) time[1] = 0;
-                else time[1] = digits[0];
+/* Sets t's time to what is left until the deadline, or on a stopwatch
+ * to the time since. */
+void update_hour(countdown_t *t) {
+        struct timespec now;
+        long long left, unit = t->coarse ? COARSE_NS : frac_unit();
+        unsigned int frac, seconds, minutes, hours;
+
+        if (t->paused) {
+                left = t->left_ns;
         } else {
-                time[0] = digits[0];
-                time[1] = digits[1];
+                clock_now(&now);
+                left = ts_diff_ns(&t->deadline, &now);
         }
-}
-
 
-void key_event(void) {
-        int i, c;
+        /* Round up to the last digit shown, so the full duration shows
+         * first and zero shows from the deadline on. A stopwatch rounds
+         * down, and stops at the most its digits hold. */
+        if (t->up) {
+                left = left >= 0 ? 0 : -left / unit;
+                if (left >= 100 * 3600 * (NSEC_PER_SEC / unit))
+                        left = 100 * 3600 * (NSEC_PER_SEC / unit) - 1;
+        } else {
+                left = left <= 0 ? 0 : (left + unit - 1) / unit;
+        }
+        if (t->coarse) {
+                frac = 0;
+                left *= COARSE_NS / NSEC_PER_SEC;
+        } else {
+                frac = left % (NSEC_PER_SEC / unit);
+                left /= NSEC_PER_SEC / unit;
+        }
 
-        // s delay and ns delay.
-        struct timespec length = { 1, 0 };
-        switch(c = wgetch(stdscr)) {
-        case 'q':
-        case 'Q':
-                ttyclock->running = False;
-                break;
+        hours = left / 3600;
+        minutes = left / 60 % 60;
+        seconds = left % 60;
 
-        case 'r':
-        case 'R':
-                fill_ttyclock_time(ttyclock->initial_digits,
-                                   ttyclock->date.hour);
-                fill_ttyclock_time(ttyclock->initial_digits + 2,
-                                   ttyclock->date.minute);
-                fill_ttyclock_time(ttyclock->initial_digits + 4,
-                                   ttyclock->date.second);
-                break;
+        /* Put it all back into t. */
+        t->date.hour[0] = hours / 10;
+        t->date.hour[1] = hours % 10;
 
-        default:
-                #ifdef TOOT
-                if (time_is_zero() && time(NULL) % 2 == 0) toot(500, 1000);
-                else
-                #endif
-                        nanosleep(&length, NULL);
+        t->date.minute[0] = minutes / 10;
+        t->date.minute[1] = minutes % 10;
 
-                for (i = 0; i < 8; ++i) {
-                        if (c == (i + '0')) {
-                                ttyclock->option.color = i;
-                                init_pair(1, ttyclock->bg, i);
-                                init_pair(2, i, ttyclock->bg);
-                        }
-                }
+        t->date.second[0] = seconds / 10;
+        t->date.second[1] = seconds % 10;
 
-                break;
+        if (ttyclock->option.frac == 2) {
+                t->date.frac[0] = frac / 10;
+                t->date.frac[1] = frac % 10;
+        } else {
+                t->date.frac[0] = frac;
         }
 }
 
-/* Parses time into ttyclock->date.hour/minute/second. Exits with
- * an error message on bad time format. Sets timestr to what was
- * parsed.
- * time format: hh:mm:ss, where all but the colons are optional.
- */
-static void parse_time_arg(char *time) {
-        int digits[N_TIME_DIGITS];
-        for (int i = 0; i < N_TIME_DIGITS; ++i) digits[i] = -1;
+/* Returns the cached run of cells for row row of digit n in color. */
+static chtype *glyph_row(int n, int color, int row) {
+        const font_t *font = ttyclock->option.font;
+        int w = font->w * ttyclock->scale;
 
-        int i = 0, remaining = 2;
-        while (*time != '\0') {
-                if (isdigit(*time)) {
-                        if (remaining == 0) {
-                                puts("Too many digits in time argument");
-                                exit(EXIT_FAILURE);
-                        }
+        return ttyclock->glyph + ((n * 3 + color) * font->h + row) * w;
+}
 
-                        digits[i] = *time - '0';
-                        ++i;
-                        --remaining;
-                } else if (*time == ':') {
-                        i += remaining;
-                        remaining = 2;
-                } else {
-                        puts("Invalid character in time argument");
-                        exit(EXIT_FAILURE);
-                }
+/* Renders every digit in every number color from the spans of the font,
+ * so drawing a digit is a copy of a few ready-made rows. Has to be redone
+ * whenever the color, bold option, font or scale changes. */
+void build_glyphs(void) {
+        const font_t *font = ttyclock->option.font;
+        int n, color, row, i, k = ttyclock->scale;
+        int w = font->w * k;
+        chtype attr = ttyclock->option.bold ? A_BLINK : 0;
+        const span_t *s, *end;
+        chtype *run;
 
-                ++time;
+        if (k != ttyclock->glyphscale || font != ttyclock->glyphfont) {
+                free(ttyclock->glyph);
+                ttyclock->glyph = malloc(10 * 3 * font->h * w * sizeof(chtype));
+                assert(ttyclock->glyph != NULL);
+                ttyclock->glyphscale = k;
+                ttyclock->glyphfont = font;
         }
 
-        fill_ttyclock_time(digits, ttyclock->date.hour);
-        fill_ttyclock_time(digits + 2, ttyclock->date.minute);
-        fill_ttyclock_time(digits + 4, ttyclock->date.second);
-        memcpy(ttyclock->initial_digits, digits, N_TIME_DIGITS * sizeof(int));
+        /* Each column of a span becomes k columns, and each row k rows;
+         * the k rows are the same run, so only one is kept. */
+        for (n = 0; n < 10; ++n)
+                for (color = 0; color < 3; ++color)
+                        for (row = 0; row < font->h; ++row) {
+                                run = glyph_row(n, color, row);
+                                for (i = 0; i < w; ++i)
+                                        run[i] = ' ' | attr | COLOR_PAIR(0);
 
-        ttyclock->date.timestr[0] = ttyclock->date.hour[0] + '0';
-        ttyclock->date.timestr[1] = ttyclock->date.hour[1] + '0';
-        ttyclock->date.timestr[2] = ':';
-        ttyclock->date.timestr[3] = ttyclock->date.minute[0] + '0';
-        ttyclock->date.timestr[4] = ttyclock->date.minute[1] + '0';
-        ttyclock->date.timestr[5] = ':';
-        ttyclock->date.timestr[6] = ttyclock->date.second[0] + '0';
-        ttyclock->date.timestr[7] = ttyclock->date.second[1] + '0';
-        ttyclock->date.timestr[8] = '\0';
+                                s = font->span + font->row[n][row];
+                                end = font->span + font->row[n][row + 1];
+                                for (; s < end; ++s)
+                                        for (i = s->col * k;
+                                             i < (s->col + s->len) * k; ++i)
+                                                run[i] = ' ' | attr
+                                                         | COLOR_PAIR(color);
+                        }
 }
 
-/* Converts the name of a colour to its ncurses number. Case insensitive. */
-int color_name_to_number(const char *color) {
+/* Writes a run of n cells at row x, column y of the screen into the ANSI
+ * back buffer. Runs that don't fit are dropped. */
+static void ansi_put(int x, int y, const chtype *run, int n) {
+        if (x < 0 || x >= ttyclock->ansi.rows || y < 0
+            || y + n > ttyclock->ansi.cols)
+                return;
 
-        if (strcasecmp(color, "black") == 0) return COLOR_BLACK;
-        else if (strcasecmp(color, "red") == 0) return COLOR_RED;
-        else if (strcasecmp(color, "green") == 0) return COLOR_GREEN;
-        else if (strcasecmp(color, "yellow") == 0) return COLOR_YELLOW;
-        else if (strcasecmp(color, "blue") == 0) return COLOR_BLUE;
-        else if (strcasecmp(color, "magenta") == 0) return COLOR_MAGENTA;
-        else if (strcasecmp(color, "cyan") == 0) return COLOR_CYAN;
-        else if (strcasecmp(color, "white") == 0) return COLOR_WHITE;
-        else return -1;
+        memcpy(&ttyclock->ansi.back[x * ttyclock->ansi.cols + y], run,
+               n * sizeof(chtype));
+        ttyclock->ansi.dirty[x] = True;
 }
 
-int main(int argc, char **argv) {
-        int c;
+/* Writes a run of n cells at row x, column y of the screen into every
+ * curses mirror, as drawn on the terminal (see mirror_update()). */
+static void mirror_put(int x, int y, const chtype *run, int n) {
+        int i;
 
-        /* Alloc ttyclock */
-        ttyclock = malloc(sizeof(ttyclock_t));
-        assert(ttyclock != NULL);
-        memset(ttyclock, 0, sizeof(ttyclock_t));
+        for (i = 0; i < ttyclock->mirror.n; ++i)
+                mvwaddchnstr(ttyclock->mirror.term[i].win, x, y, run, n);
+}
 
-        /* Default color */
-        ttyclock->option.color = COLOR_GREEN; /* COLOR_GREEN = 2 */
+/* Writes a run of n cells at row x, column y of t's frame. */
+static void put_frame(countdown_t *t, int x, int y, const chtype *run, int n) {
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_put(t->geo.x + x, t->geo.y + y, run, n);
+                return;
+        }
 
-        atexit(cleanup);
+        mvwaddchnstr(t->framewin, x, y, run, n);
+        mirror_put(t->geo.x + x, t->geo.y + y, run, n);
+}
 
-        int color;
-        while ((c = getopt(argc, argv, "vbhxC:")) != -1) {
-                switch(c) {
-                case 'h':
-                        usage(argv[0], EXIT_SUCCESS);
-                        break;
-                case 'v':
-                        puts("ttytimer v0.1");
-                        exit(EXIT_SUCCESS);
-                        break;
-                case 'b':
-                        ttyclock->option.bold = True;
-                        break;
-                case 'C':
-                        if ((color = color_name_to_number(optarg)) != -1) {
-                                ttyclock->option.color = color;
-                        } else {
-                                printf("Invalid color specified: %s\n", optarg);
-                                exit(EXIT_FAILURE);
-                        }
+/* Column of t's date window. */
+static int date_col(countdown_t *t) {
+        return t->geo.y + (t->geo.w / 2)
+               - (strlen(t->shown.date.timestr) / 2) - 1;
+}
 
-                        break;
-                case 'x':
-                        ttyclock->option.box = True;
-                        break;
-                default:
-                        usage(argv[0], EXIT_FAILURE);
-                        break;
-                }
-        }
+/* Draws a box of h rows and w columns at row x, column y of the screen
+ * into the ANSI back buffer, with the DEC line drawing characters. */
+static void ansi_box(int x, int y, int h, int w) {
+        chtype edge[w];
+        int i;
 
-        /* We're missing the final time argument. */
-        if (optind == argc) usage(argv[0], EXIT_FAILURE);
+        edge[0] = 'l' | A_ALTCHARSET;
+        for (i = 1; i < w - 1; ++i) edge[i] = 'q' | A_ALTCHARSET;
+        edge[w - 1] = 'k' | A_ALTCHARSET;
+        ansi_put(x, y, edge, w);
+
+        edge[0] = edge[w - 1] = 'x' | A_ALTCHARSET;
+        for (i = 1; i < h - 1; ++i) {
+                ansi_put(x + i, y, edge, 1);
+                ansi_put(x + i, y + w - 1, edge, 1);
+        }
+
+        edge[0] = 'm' | A_ALTCHARSET;
+        for (i = 1; i < w - 1; ++i) edge[i] = 'q' | A_ALTCHARSET;
+        edge[w - 1] = 'j' | A_ALTCHARSET;
+        ansi_put(x + h - 1, y, edge, w);
+}
+
+/* Draws a scaled dot at x, y of t's frame, 2 * scale cells of dots wide
+ * and scale rows high. */
+static void draw_dot(countdown_t *t, int x, int y, chtype *dots) {
+        int i, k = ttyclock->scale;
+
+        for (i = 0; i < k; ++i)
+                put_frame(t, x + i, y, dots, 2 * k);
+        ttyclock->drawn.cells += 2 * k * k;
+}
+
+/* Draws digit n at position pos of t's clock, copying only the glyph rows
+ * that differ from what is already on screen there. */
+void draw_number(countdown_t *t, int pos, int n, int x, int y,
+                 unsigned int color) {
+        int row;
+        int old = t->drawn.digit[pos];
+        unsigned int oldcolor = t->drawn.numcolor[pos];
+        int i, k = ttyclock->scale, w = ttyclock->option.font->w * k;
+        chtype *run;
+
+        if (old == n && oldcolor == color) return;
+
+        for (row = 0; row < ttyclock->option.font->h; ++row) {
+                run = glyph_row(n, color, row);
+                if (old != -1 && memcmp(run, glyph_row(old, oldcolor, row),
+                                        w * sizeof(chtype)) == 0)
+                        continue;
+
+                for (i = 0; i < k; ++i)
+                        put_frame(t, x + row * k + i, y, run, w);
+                ttyclock->drawn.cells += w * k;
+        }
+
+        t->drawn.digit[pos] = n;
+        t->drawn.numcolor[pos] = color;
+}
+
+/* Forces the next draw_clock() of t to redraw everything. */
+void invalidate_clock(countdown_t *t) {
+        int i;
+
+        for (i = 0; i < N_DIGITS; ++i) t->drawn.digit[i] = -1;
+        t->drawn.dotcolor = 0;
+        t->drawn.point = False;
+        t->drawn.date = False;
+        t->redraw = True;
+        ttyclock->mirror.sync = True;
+}
+
+/* Draws what changed on t's clock since the last frame. The windows go
+ * to the terminal with the next doupdate() or ansi_flush(). */
+void draw_clock(countdown_t *t) {
+        chtype dotcolor = COLOR_PAIR(1);
+        int dotw = 2 * ttyclock->scale;
+        const date_t *d = &t->shown.date;
+        chtype dots[dotw], date[sizeof(d->timestr)], attr;
+        unsigned int numcolor = 1;
+        Bool full = !t->drawn.date, coarse = t->shown.coarse;
+        int i, x, n = strlen(d->timestr), h = ttyclock->option.font->h;
+
+        /* Change the colours to blink at certain times. */
+        if (t->shown.lit) {
+                dotcolor = COLOR_PAIR(2);
+                if (!t->up && time_is_zero(d)) numcolor = 2;
+        }
+
+        if (ttyclock->option.bold) dotcolor |= A_BLINK;
+
+        /* The ANSI backend has no windows to keep the box in. */
+        if (full && ttyclock->option.backend == BACKEND_ANSI
+            && ttyclock->option.box) {
+                ansi_box(t->geo.x, t->geo.y, t->geo.h, t->geo.w);
+                ansi_box(t->geo.x + t->geo.h - 1, date_col(t), DATEWINH, n + 2);
+        }
+
+        /* Draw hour numbers */
+        draw_number(t, 0, d->hour[0], 1, scaled(digit_col(0)), numcolor);
+        draw_number(t, 1, d->hour[1], 1, scaled(digit_col(1)), numcolor);
+
+        /* Draw minute numbers */
+        draw_number(t, 2, d->minute[0], 1, scaled(digit_col(2)), numcolor);
+        draw_number(t, 3, d->minute[1], 1, scaled(digit_col(3)), numcolor);
+
+        /* Draw second numbers, unless the frame is too narrow for them */
+        if (!coarse) {
+                draw_number(t, 4, d->second[0], 1, scaled(digit_col(4)),
+                            numcolor);
+                draw_number(t, 5, d->second[1], 1, scaled(digit_col(5)),
+                            numcolor);
+
+                /* Draw fractions of a second after a point */
+                for (i = 0; i < ttyclock->option.frac; ++i)
+                        draw_number(t, N_TIME_DIGITS + i, d->frac[i], 1,
+                                    scaled(digit_col(N_TIME_DIGITS + i)),
+                                    numcolor);
+        }
+
+        if (ttyclock->option.frac && !coarse && !t->drawn.point) {
+                for (i = 0; i < dotw; ++i) dots[i] = ' ' | COLOR_PAIR(1);
+                draw_dot(t, scaled(h), scaled(digit_col(N_TIME_DIGITS) - 3),
+                         dots);
+                t->drawn.point = True;
+        }
+
+        /* 2 dot for number separation, for minutes and seconds, a row
+         * either side of the middle of the digits */
+        if (dotcolor != t->drawn.dotcolor) {
+                for (i = 0; i < dotw; ++i) dots[i] = ' ' | dotcolor;
+                draw_dot(t, scaled(h / 2), scaled(digit_col(2) - 4), dots);
+                draw_dot(t, scaled(h / 2 + 2), scaled(digit_col(2) - 4), dots);
+                if (!coarse) {
+                        draw_dot(t, scaled(h / 2), scaled(digit_col(4) - 4),
+                                 dots);
+                        draw_dot(t, scaled(h / 2 + 2),
+                                 scaled(digit_col(4) - 4), dots);
+                }
+                t->drawn.dotcolor = dotcolor;
+        }
+
+        /* Draw the date, highlighted on the timer the keys act on */
+        if (!t->drawn.date) {
+                attr = COLOR_PAIR(2);
+                if (ttyclock->option.bold) attr |= A_BOLD;
+                if (ttyclock->ntimers > 1
+                    && t == &ttyclock->timer[ttyclock->render.cur.selected])
+                        attr |= A_REVERSE;
+
+                for (i = 0; i < n; ++i)
+                        date[i] = (unsigned char)d->timestr[i] | attr;
+
+                x = t->geo.x + t->geo.h - 1 + DATEWINH / 2;
+                if (ttyclock->option.backend == BACKEND_ANSI) {
+                        ansi_put(x, date_col(t) + 1, date, n);
+                } else {
+                        mvwaddchnstr(t->datewin, DATEWINH / 2, 1, date, n);
+                        mirror_put(x, date_col(t) + 1, date, n);
+                }
+
+                t->drawn.date = True;
+                ttyclock->drawn.cells += n;
+        }
+
+        if (ttyclock->option.backend == BACKEND_ANSI) return;
+
+        /* After a relayout other tiles may have been erased over this one. */
+        if (full) {
+                touchwin(t->framewin);
+                touchwin(t->datewin);
+        }
+
+        wnoutrefresh(t->framewin);
+        wnoutrefresh(t->datewin);
+        ttyclock->stats.refreshes += 2;
+}
+
+/* Shows the last lap of stopwatch t after its label: its number and
+ * split, in hundredths. */
+static void lap_show(countdown_t *t) {
+        long long split = t->lap_split / (NSEC_PER_SEC / 100);
+
+        snprintf(t->date.timestr + t->labellen,
+                 sizeof(t->date.timestr) - t->labellen,
+                 " lap %lu %02lld:%02lld:%02lld.%02lld", t->laps,
+                 split / 360000, split / 6000 % 60, split / 100 % 60,
+                 split % 100);
+        t->lap_shown = t->laps;
+}
+
+/* Publishes the timers that ticked or changed to be drawn, with what
+ * else the screen has to do (see render_frame()). This is the writer's
+ * half of a seqlock: seq is odd while the snapshot is being written. */
+static void publish_timers(void) {
+        unsigned long seq;
+        struct timespec now;
+        Bool all = False;
+        shown_t *s;
+        countdown_t *t;
+        int i, n = ttyclock->ntimers;
+
+        /* Only before the render thread starts, or without one. */
+        if (ttyclock->render.n != n) {
+                free(ttyclock->render.timer);
+                free(ttyclock->render.read);
+                ttyclock->render.timer = calloc(n, sizeof(shown_t));
+                ttyclock->render.read = calloc(n, sizeof(shown_t));
+                if (!ttyclock->render.timer || !ttyclock->render.read) {
+                        perror("ttytimer");
+                        exit(EXIT_FAILURE);
+                }
+                ttyclock->render.n = n;
+                ttyclock->render.want.color = ttyclock->option.color;
+                ttyclock->render.cur.color = ttyclock->option.color;
+                all = True;
+        }
+
+        /* Everything but the copy is done outside the write, so a reader
+         * spins for as short as can be. */
+        for (i = 0; i < n; ++i) {
+                t = &ttyclock->timer[i];
+                if (!t->dirty && !all) continue;
+                if (t->lap_shown != t->laps) lap_show(t);
+                update_hour(t);
+        }
+
+        clock_now(&now);
+        seq = atomic_load_explicit(&ttyclock->render.seq, memory_order_relaxed);
+        atomic_store_explicit(&ttyclock->render.seq, seq + 1,
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        for (i = 0; i < n; ++i) {
+                t = &ttyclock->timer[i];
+                if (!t->dirty && !all) continue;
+
+                /* A coarse clock doesn't blink, as it is only drawn
+                 * once a minute. */
+                s = &ttyclock->render.timer[i];
+                memcpy(&s->date, &t->date, sizeof(s->date));
+                s->coarse = t->coarse;
+                s->lit = now.tv_sec % 2 == 0 && !t->coarse;
+                t->dirty = False;
+        }
+        ttyclock->render.want.selected = ttyclock->selected;
+        ttyclock->render.want.at = now;
+        ttyclock->render.pub = ttyclock->render.want;
+
+        atomic_store_explicit(&ttyclock->render.seq, seq + 2,
+                              memory_order_release);
+        ++ttyclock->render.published;
+}
+
+/* Updates every timer that ticked or changed, and has it drawn: by the
+ * render thread if there is one, or right away. */
+void draw_timers(void) {
+        if (ttyclock->option.backend == BACKEND_STREAM) {
+                stream_timers();
+                startup_mark(START_FRAME);
+                return;
+        }
+
+        publish_timers();
+        if (ttyclock->render.started) efd_wake(ttyclock->render.evfd);
+        else render_frame();
+}
+
+void clock_move(countdown_t *t, int x, int y, int w, int h) {
+        /* Erase border for a clean move */
+        wbkgdset(t->framewin, COLOR_PAIR(0));
+        wborder(t->framewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
+        werase(t->framewin);
+        wnoutrefresh(t->framewin);
+
+        wbkgdset(t->datewin, COLOR_PAIR(0));
+        wborder(t->datewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
+        werase(t->datewin);
+        wnoutrefresh(t->datewin);
+
+        /* Frame win move. Resize first: resizeterm() may have stretched
+         * the window so that it no longer fits at the new place. */
+        wresize(t->framewin, (t->geo.h = h), (t->geo.w = w));
+        mvwin(t->framewin, (t->geo.x = x), (t->geo.y = y));
+
+        /* Date win move */
+        wresize(t->datewin, DATEWINH, strlen(t->shown.date.timestr) + 2);
+        mvwin(t->datewin,
+              t->geo.x + t->geo.h - 1,
+              t->geo.y + (t->geo.w / 2)
+              - (strlen(t->shown.date.timestr) / 2) - 1);
+
+        if (ttyclock->option.box) box(t->datewin,  0, 0);
+
+        if (ttyclock->option.box) box(t->framewin, 0, 0);
+
+        wnoutrefresh(t->framewin);
+        wnoutrefresh(t->datewin);
+        ttyclock->stats.refreshes += 4;
+
+        invalidate_clock(t);
+}
+
+/* Resizes t's frame to show or hide its seconds, as frame_width() says
+ * now, and lays the tiles out again. */
+void set_second(countdown_t *t) {
+        t->redraw = True;
+        set_center();
+}
+
+/* Returns how many rows of tiles n timers take on a terminal columns
+ * wide at the current scale, and in *cols how many go on a row. */
+static int tile_rows(int n, int columns, int *cols) {
+        *cols = (columns + TILEGAPW) / (frame_width(NULL) + TILEGAPW);
+        if (*cols < 1) *cols = 1;
+        if (*cols > n) *cols = n;
+
+        return (n + *cols - 1) / *cols;
+}
+
+/* With -z, picks the largest scale at which every timer fits the
+ * terminal, and rasterises the glyphs again if it changed. */
+static void set_scale(int n, int lines, int columns) {
+        int k = ttyclock->scale, cols, rows;
+
+        if (!ttyclock->option.fill) return;
+
+        for (ttyclock->scale = 1; ; ++ttyclock->scale) {
+                rows = tile_rows(n, columns, &cols);
+                if (frame_width(NULL) > columns
+                    || rows * (frame_height() + DATEWINH - 1 + TILEGAPH)
+                       - TILEGAPH > lines)
+                        break;
+        }
+        if (ttyclock->scale > 1) --ttyclock->scale;
+
+        if (ttyclock->scale != k) build_glyphs();
+}
+
+/* Lays the timers out in a grid of tiles, centered on the screen. A
+ * single timer is centered exactly as before. Tiles that don't fit are
+ * hidden. */
+void set_center(void) {
+        int n = ttyclock->ntimers;
+        int lines, columns, cols, rows, x0, y0, x, y, i;
+        int tilew, tileh;
+        countdown_t *t;
+
+        if (n == 0) return;
+
+        screen_size(&lines, &columns);
+        set_scale(n, lines, columns);
+        tilew = frame_width(NULL) + TILEGAPW;
+        tileh = frame_height() + DATEWINH - 1 + TILEGAPH;
+
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                for (i = 0; i < lines * columns; ++i)
+                        ttyclock->ansi.back[i] = ' ';
+                for (i = 0; i < lines; ++i) ttyclock->ansi.dirty[i] = True;
+        }
+
+        rows = tile_rows(n, columns, &cols);
+
+        x0 = lines / 2 - ((rows - 1) * tileh + frame_height()) / 2;
+        y0 = columns / 2 - (cols * tilew - TILEGAPW) / 2;
+        if (n > 1 && x0 < 0) x0 = 0;
+        if (n > 1 && y0 < 0) y0 = 0;
+
+        for (i = 0; i < n; ++i) {
+                t = &ttyclock->timer[i];
+                x = x0 + i / cols * tileh;
+                y = y0 + i % cols * tilew
+                    + (tilew - TILEGAPW - frame_width(t)) / 2;
+
+                if (ttyclock->option.backend == BACKEND_ANSI) {
+                        t->geo.x = x;
+                        t->geo.y = y;
+                        t->geo.w = frame_width(t);
+                        t->geo.h = frame_height();
+                        invalidate_clock(t);
+                } else if (!t->framewin) {
+                        /* Nothing to erase or move yet */
+                        t->geo.x = x;
+                        t->geo.y = y;
+                        init_timer(t);
+                        invalidate_clock(t);
+                } else {
+                        clock_move(t, x, y, frame_width(t), frame_height());
+                }
+                t->hidden = x < 0 || y < 0
+                            || x + t->geo.h + DATEWINH - 1 > lines
+                            || y + t->geo.w > columns;
+        }
+}
+
+void set_box(Bool b) {
+        countdown_t *t;
+        int i;
+
+        ttyclock->option.box = b;
+        ttyclock->mirror.sync = True;
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                t = &ttyclock->timer[i];
+
+                wbkgdset(t->framewin, COLOR_PAIR(0));
+                wbkgdset(t->datewin, COLOR_PAIR(0));
+
+                if(ttyclock->option.box) {
+                        box(t->framewin, 0, 0);
+                        box(t->datewin,  0, 0);
+                } else {
+                        wborder(t->framewin, ' ', ' ', ' ', ' ', ' ', ' ',
+                                ' ', ' ');
+                        wborder(t->datewin, ' ', ' ', ' ', ' ', ' ', ' ',
+                                ' ', ' ');
+                }
+
+                wnoutrefresh(t->datewin);
+                wnoutrefresh(t->framewin);
+        }
+
+        doupdate();
+}
+
+/* Raw ANSI backend. The frame is drawn into a shadow grid of chtypes, and
+ * only the cells that differ from what the terminal shows are sent, as
+ * cursor moves and SGR sequences in one write() per frame. It needs
+ * neither ncurses nor terminfo. */
+
+static const char ansi_enter[] = "\033[?1049h\033[?25l";
+
+/* --record. Each frame's bytes become an asciicast v2 event, stamped
+ * with the time its snapshot was published, so a replay shows the
+ * frames at the ticks they were drawn for. */
+
+/* Checks that n more bytes of the frame fit in the ring. If not, the
+ * frame is dropped once it ends (see record_frame()). */
+static Bool record_room(size_t n) {
+        uint64_t end = ttyclock->record.pending + n;
+
+        if (ttyclock->record.drop) return False;
+
+        /* Nothing is kept once the reader has gone (see record_writer()). */
+        if (atomic_load_explicit(&ttyclock->record.ended,
+                                 memory_order_relaxed))
+                return False;
+
+        /* The writer's tail is only read again once the ring looks full. */
+        if (end - ttyclock->record.tail_seen > RECORD_RING)
+                ttyclock->record.tail_seen = atomic_load_explicit(
+                        &ttyclock->record.tail, memory_order_acquire);
+        if (end - ttyclock->record.tail_seen > RECORD_RING)
+                ttyclock->record.drop = True;
+
+        return !ttyclock->record.drop;
+}
+
+/* Puts len bytes into the ring as they are, after the frame so far. */
+static void record_put(const char *buf, size_t len) {
+        size_t i;
+
+        for (i = 0; i < len; ++i)
+                ttyclock->record.ring[ttyclock->record.pending++
+                                      % RECORD_RING] = buf[i];
+}
+
+/* Starts an event of the given type at the frame's time, ending the
+ * one before it. The caller has made room for it. */
+static void record_event(const char *type) {
+        long long ns = ts_diff_ns(&ttyclock->record.at, &ttyclock->record.start);
+        char head[64];
+
+        if (ttyclock->record.open) record_put("\"]\n", 3);
+        if (ns < 0) ns = 0;
+        record_put(head, snprintf(head, sizeof(head), "[%lld.%06lld, \"%s\", \"",
+                                  ns / NSEC_PER_SEC,
+                                  ns % NSEC_PER_SEC / 1000, type));
+        ttyclock->record.open = True;
+}
+
+/* Adds len bytes sent to the terminal to the frame being recorded,
+ * escaped for a JSON string. Only control characters, quotes and
+ * backslashes are escaped; a label's UTF-8 goes in as it is. */
+static void record_out(const char *buf, size_t len) {
+        static const char hex[] = "0123456789abcdef";
+        char *ring = ttyclock->record.ring;
+        size_t i, n = len;
+        unsigned char c;
+
+        if (!ring || len == 0) return;
+
+        /* Room for the bytes as escaped, and the event around them */
+        for (i = 0; i < len; ++i) {
+                c = buf[i];
+                if (c == '"' || c == '\\') n += 1;
+                else if (c < 0x20 || c == 0x7f) n += 5;
+        }
+        if (!record_room(n + 128)) return;
+
+        if (!ttyclock->record.open) record_event("o");
+        for (i = 0; i < len; ++i) {
+                c = buf[i];
+                if (c == '"' || c == '\\') {
+                        ring[ttyclock->record.pending++ % RECORD_RING] = '\\';
+                        ring[ttyclock->record.pending++ % RECORD_RING] = c;
+                } else if (c < 0x20 || c == 0x7f) {
+                        record_put("\\u00", 4);
+                        ring[ttyclock->record.pending++ % RECORD_RING] = hex[c >> 4];
+                        ring[ttyclock->record.pending++ % RECORD_RING] = hex[c & 15];
+                } else {
+                        ring[ttyclock->record.pending++ % RECORD_RING] = c;
+                }
+        }
+}
+
+/* Records the terminal's new size. */
+static void record_resize(int rows, int cols) {
+        char size[32];
+
+        if (!ttyclock->record.ring || !record_room(128)) return;
+
+        record_event("r");
+        record_put(size, snprintf(size, sizeof(size), "%dx%d", cols, rows));
+        record_put("\"]\n", 3);
+        ttyclock->record.open = False;
+}
+
+/* Writes what went to the terminal to every mirror as well. A mirror
+ * that fails is left behind rather than stopping the clock. */
+static void mirror_write(const char *buf, size_t len) {
+        size_t done;
+        ssize_t n;
+        int i;
+
+        for (i = 0; i < ttyclock->mirror.n; ++i) {
+                for (done = 0; done < len; done += n) {
+                        n = write(ttyclock->mirror.term[i].fd, buf + done,
+                                  len - done);
+                        if (n < 0 && errno == EINTR) n = 0;
+                        else if (n <= 0) break;
+                }
+        }
+}
+
+/* Takes the terminal over and sets up the shadow grid. */
+void ansi_init(void) {
+        struct termios raw;
+        int i;
+
+        ttyclock->bg = -1;
+
+        if (tcgetattr(ttyclock->ttyfd, &ttyclock->ansi.saved) == 0) {
+                raw = ttyclock->ansi.saved;
+                raw.c_lflag &= ~(ICANON | ECHO);
+                raw.c_cc[VMIN] = 0;
+                raw.c_cc[VTIME] = 0;
+                tcsetattr(ttyclock->ttyfd, TCSANOW, &raw);
+        }
+
+        if (write(ttyclock->ttyfd, ansi_enter, sizeof(ansi_enter) - 1) < 0) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        build_glyphs();
+        ttyclock->running = True;
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                ttyclock->timer[i].geo.w = frame_width(&ttyclock->timer[i]);
+                ttyclock->timer[i].geo.h = frame_height();
+                memcpy(&ttyclock->timer[i].shown.date,
+                       &ttyclock->timer[i].date, sizeof(date_t));
+        }
+
+        ansi_resize();
+        set_center();
+}
+
+/* Makes the next ansi_flush() repaint the whole terminal. With blank
+ * set the terminal is cleared instead, and only what isn't blank is sent. */
+static void ansi_repaint(Bool blank) {
+        static const char clear[] = "\033[0m\033(B\033[2J";
+        int i;
+
+        if (blank && write(ttyclock->ttyfd, clear, sizeof(clear) - 1) < 0)
+                blank = False;
+        if (blank) {
+                mirror_write(clear, sizeof(clear) - 1);
+                record_out(clear, sizeof(clear) - 1);
+        }
+
+        for (i = 0; i < ttyclock->ansi.rows * ttyclock->ansi.cols; ++i)
+                ttyclock->ansi.front[i] = blank ? ' ' : (chtype)-1;
+        for (i = 0; i < ttyclock->ansi.rows; ++i)
+                ttyclock->ansi.dirty[i] = True;
+}
+
+/* Sizes the shadow grid to the terminal and clears it. */
+void ansi_resize(void) {
+        struct winsize ws;
+        int rows = 24, cols = 80, i;
+
+        if (ioctl(ttyclock->ttyfd, TIOCGWINSZ, &ws) == 0
+            && ws.ws_row > 0 && ws.ws_col > 0) {
+                rows = ws.ws_row;
+                cols = ws.ws_col;
+        }
+
+        ttyclock->ansi.rows = rows;
+        ttyclock->ansi.cols = cols;
+        ttyclock->ansi.front = realloc(ttyclock->ansi.front,
+                                       rows * cols * sizeof(chtype));
+        ttyclock->ansi.back = realloc(ttyclock->ansi.back,
+                                      rows * cols * sizeof(chtype));
+        ttyclock->ansi.dirty = realloc(ttyclock->ansi.dirty,
+                                       rows * sizeof(Bool));
+        /* Enough for a cursor move and a full SGR before every cell. */
+        ttyclock->ansi.outsize = rows * cols * 48 + 64;
+        ttyclock->ansi.out = realloc(ttyclock->ansi.out,
+                                     ttyclock->ansi.outsize);
+        assert(ttyclock->ansi.front && ttyclock->ansi.back
+               && ttyclock->ansi.dirty && ttyclock->ansi.out);
+
+        for (i = 0; i < rows * cols; ++i) ttyclock->ansi.back[i] = ' ';
+        record_resize(rows, cols);
+        ansi_repaint(True);
+}
+
+/* Appends the SGR that selects cell c's look, and a character set switch
+ * if the last look, prev, was in the other set or is unknown. */
+static void ansi_sgr(chtype c, chtype prev) {
+        char *p = ttyclock->ansi.out + ttyclock->ansi.outlen;
+        int fg = -1, bg = -1;
+
+        switch (PAIR_NUMBER(c)) {
+        case 1:
+                fg = ttyclock->bg;
+                bg = ttyclock->option.color;
+                break;
+        case 2:
+                fg = ttyclock->option.color;
+                bg = ttyclock->bg;
+                break;
+        }
+
+        p += sprintf(p, "\033[0");
+        if (c & A_BOLD) p += sprintf(p, ";1");
+        if (c & A_BLINK) p += sprintf(p, ";5");
+        if (c & A_REVERSE) p += sprintf(p, ";7");
+        if (fg >= 0) p += sprintf(p, ";%d", 30 + fg);
+        if (bg >= 0) p += sprintf(p, ";%d", 40 + bg);
+        *p++ = 'm';
+        if (prev == (chtype)-1 || ((c ^ prev) & A_ALTCHARSET))
+                p += sprintf(p, (c & A_ALTCHARSET) ? "\033(0" : "\033(B");
+
+        ttyclock->ansi.outlen = p - ttyclock->ansi.out;
+}
+
+/* Records the whole screen as the terminal shows it now. */
+static void record_screen(void) {
+        static const char clear[] = "\033[0m\033(B\033[2J";
+        int rows = ttyclock->ansi.rows, cols = ttyclock->ansi.cols;
+        chtype look = (chtype)-1, cell;
+        int r, c;
+
+        ttyclock->ansi.outlen = 0;
+        for (r = 0; r < rows; ++r) {
+                ttyclock->ansi.outlen += sprintf(ttyclock->ansi.out
+                                                 + ttyclock->ansi.outlen,
+                                                 "\033[%d;1H", r + 1);
+                for (c = 0; c < cols; ++c) {
+                        cell = ttyclock->ansi.front[r * cols + c];
+                        if ((cell & ~A_CHARTEXT) != look) {
+                                ansi_sgr(cell & ~A_CHARTEXT, look);
+                                look = cell & ~A_CHARTEXT;
+                        }
+                        ttyclock->ansi.out[ttyclock->ansi.outlen++] =
+                                cell & A_CHARTEXT;
+                }
+        }
+
+        record_out(clear, sizeof(clear) - 1);
+        record_out(ttyclock->ansi.out, ttyclock->ansi.outlen);
+}
+
+/* Ends the frame and hands it to the writer, which is woken once a
+ * quarter of the ring is waiting. A frame that didn't fit is taken
+ * back whole, and so is every frame after it until the writer has
+ * emptied half the ring; then the whole screen is recorded instead,
+ * and the recording has caught up without a repaint of the terminal. */
+static void record_frame(void) {
+        uint64_t head = atomic_load_explicit(&ttyclock->record.head,
+                                             memory_order_relaxed);
+
+        if (!ttyclock->record.ring) return;
+
+        if (ttyclock->record.drop) {
+                ttyclock->record.pending = head;
+                ttyclock->record.open = False;
+                ++ttyclock->record.dropped;
+
+                ttyclock->record.tail_seen = atomic_load_explicit(
+                        &ttyclock->record.tail, memory_order_acquire);
+                if (head - ttyclock->record.tail_seen > RECORD_RING / 2)
+                        return;
+                ttyclock->record.drop = False;
+                record_screen();
+        }
+        if (ttyclock->record.open) {
+                record_put("\"]\n", 3);
+                ttyclock->record.open = False;
+        }
+        if (ttyclock->record.pending == head) return;
+
+        atomic_store_explicit(&ttyclock->record.head, ttyclock->record.pending,
+                              memory_order_release);
+        ++ttyclock->record.frames;
+
+        if (ttyclock->record.pending - ttyclock->record.woken >= RECORD_RING / 4) {
+                ttyclock->record.woken = ttyclock->record.pending;
+                efd_wake(ttyclock->record.evfd);
+        }
+}
+
+/* Sends the cells of the back buffer that differ from the terminal. */
+void ansi_flush(void) {
+        int rows = ttyclock->ansi.rows, cols = ttyclock->ansi.cols;
+        chtype *front = ttyclock->ansi.front, *back = ttyclock->ansi.back;
+        chtype look = (chtype)-1;
+        int r, c, cr = -1, cc = -1;
+        size_t done = 0;
+        ssize_t n;
+
+        ttyclock->ansi.outlen = 0;
+
+        for (r = 0; r < rows; ++r) {
+                if (!ttyclock->ansi.dirty[r]) continue;
+                ttyclock->ansi.dirty[r] = False;
+
+                for (c = 0; c < cols; ++c) {
+                        chtype *cell = &back[r * cols + c];
+
+                        if (front[r * cols + c] == *cell) continue;
+
+                        /* A short gap of cells in the current look is
+                         * cheaper to write again than to jump over. */
+                        if (r == cr && c > cc && c - cc < 4) {
+                                for (; cc < c; ++cc) {
+                                        if ((back[r * cols + cc] & ~A_CHARTEXT)
+                                            != look)
+                                                break;
+                                        ttyclock->ansi.out[ttyclock->ansi.outlen++] =
+                                                back[r * cols + cc] & A_CHARTEXT;
+                                }
+                        }
+
+                        if (r != cr || c != cc)
+                                ttyclock->ansi.outlen +=
+                                        sprintf(ttyclock->ansi.out
+                                                + ttyclock->ansi.outlen,
+                                                "\033[%d;%dH", r + 1, c + 1);
+                        if ((*cell & ~A_CHARTEXT) != look) {
+                                ansi_sgr(*cell & ~A_CHARTEXT, look);
+                                look = *cell & ~A_CHARTEXT;
+                        }
+
+                        ttyclock->ansi.out[ttyclock->ansi.outlen++] =
+                                *cell & A_CHARTEXT;
+                        front[r * cols + c] = *cell;
+                        cr = r;
+                        cc = c + 1;
+                }
+        }
+
+        while (done < ttyclock->ansi.outlen) {
+                n = write(ttyclock->ttyfd, ttyclock->ansi.out + done,
+                          ttyclock->ansi.outlen - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                done += n;
+        }
+
+        ttyclock->ansi.bytes += done;
+        mirror_write(ttyclock->ansi.out, ttyclock->ansi.outlen);
+        record_out(ttyclock->ansi.out, ttyclock->ansi.outlen);
+        record_frame();
+}
+
+/* Gives the terminal back as it was. */
+void ansi_end(void) {
+        static const char leave[] = "\033[0m\033(B\033[?25h\033[?1049l";
+
+        mirror_write(leave, sizeof(leave) - 1);
+        if (write(ttyclock->ttyfd, leave, sizeof(leave) - 1) < 0) return;
+        tcsetattr(ttyclock->ttyfd, TCSANOW, &ttyclock->ansi.saved);
+}
+
+/* Mirrors the timers to the terminal on fd too, from the next frame on.
+ * Call it once the main screen is set up. The mirror keeps its own size;
+ * what doesn't fit on it is cut off. */
+void mirror_open(int fd) {
+        char *term = getenv("TERM");
+        FILE *out, *in;
+        int m = ttyclock->mirror.n;
+
+        assert(m < MAX_MIRRORS);
+
+        ttyclock->mirror.term[m].fd = fd;
+        ttyclock->mirror.term[m].scr = NULL;
+        ttyclock->mirror.n = m + 1;
+
+        /* The ANSI backend sends the same bytes everywhere: a blank
+         * screen to start from is all a mirror needs. */
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                if (write(fd, ansi_enter, sizeof(ansi_enter) - 1) < 0) {
+                        perror("ttytimer");
+                        exit(EXIT_FAILURE);
+                }
+                ansi_repaint(True);
+                return;
+        }
+
+        out = fdopen(dup(fd), "w");
+        in = fdopen(dup(fd), "r");
+        if (!out || !in) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->mirror.term[m].scr =
+                newterm(term && *term ? term : "xterm", out, in);
+        if (!ttyclock->mirror.term[m].scr) {
+                fputs("Cannot set up a mirror terminal\n", stderr);
+                exit(EXIT_FAILURE);
+        }
+
+        start_color();
+        curs_set(False);
+        if (ttyclock->bg == -1) use_default_colors();
+        ttyclock->mirror.term[m].win = newwin(0, 0, 0, 0);
+
+        set_term(ttyclock->ttyscr);
+        ttyclock->mirror.sync = True;
+}
+
+/* Sends the frame just drawn to every curses mirror. Mostly that is the
+ * cells put_frame() copied there; after a move, resize, box or color
+ * change the whole screen is copied over instead. */
+void mirror_update(void) {
+        WINDOW *src = curscr, *win;
+        int lines = LINES, cols = COLS, rows, width, i, r;
+        Bool sync = ttyclock->mirror.sync;
+        chtype line[cols + 1];
+
+        ttyclock->mirror.sync = False;
+        if (ttyclock->mirror.n == 0) return;
+
+        for (i = 0; i < ttyclock->mirror.n; ++i) {
+                win = ttyclock->mirror.term[i].win;
+                set_term(ttyclock->mirror.term[i].scr);
+
+                if (sync) {
+                        init_pairs();
+                        getmaxyx(win, rows, width);
+                        if (rows > lines) rows = lines;
+                        if (width > cols) width = cols;
+
+                        werase(win);
+                        for (r = 0; r < rows; ++r) {
+                                mvwinchnstr(src, r, 0, line, width);
+                                mvwaddchnstr(win, r, 0, line, width);
+                        }
+                }
+
+                wnoutrefresh(win);
+                doupdate();
+        }
+
+        set_term(ttyclock->ttyscr);
+}
+
+/* Headless --stream output: a record per tick instead of a frame, as
+ * JSON lines or stream_record_t. Records queue in one buffer, written
+ * without blocking. A reader that falls behind gets the latest state of
+ * every timer rather than each record (see stream_timers()). */
+
+/* Takes over the output, stdout or the --stream file or FIFO. */
+void stream_open(void) {
+        int fd = STDOUT_FILENO;
+
+        if (ttyclock->stream.path) {
+                /* A FIFO waits here for its reader. */
+                fd = open(ttyclock->stream.path,
+                          O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                if (fd == -1) {
+                        perror(ttyclock->stream.path);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        ttyclock->stream.fd = fd;
+        ttyclock->stream.flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, ttyclock->stream.flags | O_NONBLOCK);
+
+        ttyclock->stream.buf = malloc(STREAM_BUFSIZE);
+        assert(ttyclock->stream.buf != NULL);
+
+        /* A reader that went away is counted as dropping everything. */
+        signal(SIGPIPE, SIG_IGN);
+
+        /* A bell or flash would land in the records. */
+        if (ttyclock->alarm.kind != ALARM_TOOT)
+                ttyclock->alarm.kind = ALARM_OFF;
+
+        ttyclock->running = True;
+}
+
+/* Has the timers whose done event is in a queued record from the one at
+ * off on, about to be dropped, send it again in a record of their own. */
+static void stream_undone(size_t off) {
+        const char *buf = ttyclock->stream.buf, *nl;
+        const char done[] = ",\"event\":\"done\"}";
+        size_t len = ttyclock->stream.len, end;
+        stream_record_t rec;
+        int i;
+
+        if (ttyclock->stream.binary) {
+                for (off -= off % sizeof(rec); off < len; off += sizeof(rec)) {
+                        memcpy(&rec, buf + off, sizeof(rec));
+                        if (!rec.event) continue;
+                        ttyclock->timer[rec.timer].streamed = -1;
+                        ttyclock->timer[rec.timer].dirty = True;
+                }
+                return;
+        }
+
+        while (off > 0 && buf[off - 1] != '\n') --off;
+        for (; off < len; off = end) {
+                nl = memchr(buf + off, '\n', len - off);
+                end = nl ? (size_t)(nl - buf) + 1 : len;
+                if (end - off <= sizeof(done)
+                    || memcmp(buf + end - sizeof(done), done, sizeof(done) - 1)
+                    || sscanf(buf + off, "{\"seq\":%*[0-9],\"timer\":%d",
+                              &i) != 1)
+                        continue;
+                ttyclock->timer[i].streamed = -1;
+                ttyclock->timer[i].dirty = True;
+        }
+}
+
+/* Returns the end of the queued record at off, and in *n how many
+ * records follow it up to the end of the queue. */
+static size_t stream_split(size_t off, uint64_t *n) {
+        const char *buf = ttyclock->stream.buf;
+        size_t len = ttyclock->stream.len, end, i;
+
+        if (ttyclock->stream.binary) {
+                end = (off + sizeof(stream_record_t) - 1)
+                      / sizeof(stream_record_t) * sizeof(stream_record_t);
+                *n = (len - end) / sizeof(stream_record_t);
+                return end;
+        }
+
+        for (end = off; end > 0 && end < len && buf[end - 1] != '\n'; ++end);
+        for (*n = 0, i = end; i < len; ++i)
+                if (buf[i] == '\n') ++*n;
+
+        return end;
+}
+
+/* Writes what is queued, as far as the reader takes it now. */
+void stream_flush(void) {
+        uint64_t dropped;
+        size_t end;
+        ssize_t n;
+
+        while (ttyclock->stream.sent < ttyclock->stream.len) {
+                n = write(ttyclock->stream.fd,
+                          ttyclock->stream.buf + ttyclock->stream.sent,
+                          ttyclock->stream.len - ttyclock->stream.sent);
+                if (n > 0) {
+                        ttyclock->stream.sent += n;
+                } else if (n < 0 && errno == EINTR) {
+                        continue;
+                } else if (n < 0 && errno == EAGAIN) {
+                        return;
+                } else {
+                        /* Nobody to write to: drop it all, with the
+                         * record cut short if there is one. */
+                        stream_undone(ttyclock->stream.sent);
+                        end = stream_split(ttyclock->stream.sent, &dropped);
+                        ttyclock->stream.dropped += dropped
+                                + (end != ttyclock->stream.sent);
+                        break;
+                }
+        }
+
+        ttyclock->stream.len = ttyclock->stream.sent = 0;
+}
+
+/* Copies s into out as a JSON string body, and returns its length. */
+static size_t json_escape(char *out, const char *s) {
+        size_t n = 0;
+
+        for (; *s; ++s) {
+                if (*s == '"' || *s == '\\') {
+                        out[n++] = '\\';
+                        out[n++] = *s;
+                } else if ((unsigned char)*s < 0x20) {
+                        n += sprintf(out + n, "\\u%04x", *s);
+                } else {
+                        out[n++] = *s;
+                }
+        }
+
+        return n;
+}
+
+/* Queues a record of timer i as it is at now. */
+static void stream_record(int i, const struct timespec *now) {
+        countdown_t *t = &ttyclock->timer[i];
+        char *out = ttyclock->stream.buf + ttyclock->stream.len;
+        stream_record_t rec;
+        long long left;
+        Phase phase;
+        int n = 0, d;
+
+        left = t->paused ? t->left_ns : ts_diff_ns(&t->deadline, now);
+        if (left < 0 && !t->up) left = 0;
+        phase = t->paused ? PHASE_PAUSED
+                : left || t->up ? PHASE_RUNNING : PHASE_DONE;
+
+        if (ttyclock->stream.len + STREAM_RECMAX > STREAM_BUFSIZE) {
+                ++ttyclock->stream.dropped;
+                return;
+        }
+
+        if (ttyclock->stream.binary) {
+                memset(&rec, 0, sizeof(rec));
+                rec.seq = ttyclock->stream.seq;
+                rec.left_ns = left;
+                rec.dropped = ttyclock->stream.dropped;
+                rec.timer = i;
+                rec.phase = phase;
+                rec.event = phase == PHASE_DONE && t->streamed != PHASE_DONE;
+                memcpy(out, &rec, sizeof(rec));
+                n = sizeof(rec);
+        } else {
+                n = sprintf(out, "{\"seq\":%llu,\"timer\":%d,\"name\":\"",
+                            (unsigned long long)ttyclock->stream.seq, i);
+                n += json_escape(out + n, t->date.timestr);
+                n += sprintf(out + n, "\",\"phase\":\"%s\",\"left_ns\":%lld,"
+                             "\"shown\":\"%u%u:%u%u:%u%u",
+                             phase == PHASE_RUNNING ? "running"
+                             : phase == PHASE_PAUSED ? "paused" : "done",
+                             left, t->date.hour[0], t->date.hour[1],
+                             t->date.minute[0], t->date.minute[1],
+                             t->date.second[0], t->date.second[1]);
+                for (d = 0; d < ttyclock->option.frac; ++d)
+                        n += sprintf(out + n, "%s%u", d ? "" : ".",
+                                     t->date.frac[d]);
+                n += sprintf(out + n, "\",\"dropped\":%llu%s}\n",
+                             (unsigned long long)ttyclock->stream.dropped,
+                             phase == PHASE_DONE && t->streamed != PHASE_DONE
+                             ? ",\"event\":\"done\"" : "");
+        }
+
+        ttyclock->stream.len += n;
+        ++ttyclock->stream.seq;
+        t->streamed = phase;
+}
+
+/* Queues a record of every timer that ticked or changed, and writes
+ * what the reader takes. A reader still busy with older records keeps
+ * the one it is in the middle of; the ones after it are dropped and
+ * counted, and every timer is sent again as it is now. */
+void stream_timers(void) {
+        struct timespec now;
+        uint64_t n = 0;
+        size_t keep;
+        int i;
+
+        if (ttyclock->stream.sent < ttyclock->stream.len) {
+                keep = stream_split(ttyclock->stream.sent, &n);
+                stream_undone(keep);
+                ttyclock->stream.len = keep;
+                ttyclock->stream.dropped += n;
+        }
+
+        memmove(ttyclock->stream.buf,
+                ttyclock->stream.buf + ttyclock->stream.sent,
+                ttyclock->stream.len - ttyclock->stream.sent);
+        ttyclock->stream.len -= ttyclock->stream.sent;
+        ttyclock->stream.sent = 0;
+
+        clock_now(&now);
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                if (!ttyclock->timer[i].dirty && n == 0) continue;
+
+                update_hour(&ttyclock->timer[i]);
+                stream_record(i, &now);
+                ttyclock->timer[i].dirty = False;
+        }
+
+        stream_flush();
+}
+
+/* Writes what it can of the last records and gives the output back. */
+void stream_end(void) {
+        stream_flush();
+        fcntl(ttyclock->stream.fd, F_SETFL, ttyclock->stream.flags);
+        if (ttyclock->stream.path) close(ttyclock->stream.fd);
+}
+
+/* --record's writer, off the render thread, and --replay, which plays
+ * a recording back without setting up a clock at all. */
+
+/* Writes the recorded frames out as they come, at least every
+ * RECORD_FLUSH_MS, and all of them before it quits. */
+static void *record_writer(void *arg) {
+        uint64_t head, tail;
+        size_t off, len;
+        ssize_t n;
+        Bool quit;
+
+        (void)arg;
+
+        do {
+                quit = atomic_load(&ttyclock->record.quit);
+                if (!quit) efd_wait(ttyclock->record.evfd, RECORD_FLUSH_MS);
+
+                tail = atomic_load_explicit(&ttyclock->record.tail,
+                                            memory_order_relaxed);
+                head = atomic_load_explicit(&ttyclock->record.head,
+                                            memory_order_acquire);
+                while (tail != head) {
+                        off = tail % RECORD_RING;
+                        len = head - tail;
+                        if (len > RECORD_RING - off) len = RECORD_RING - off;
+
+                        n = write(ttyclock->record.fd,
+                                  ttyclock->record.ring + off, len);
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n < 0 && errno == EPIPE) {
+                                /* The reader of a pipe went away: that
+                                 * is the end of the recording. */
+                                atomic_store(&ttyclock->record.ended, True);
+                                return NULL;
+                        }
+                        if (n <= 0) break;
+
+                        tail += n;
+                        atomic_store_explicit(&ttyclock->record.tail, tail,
+                                              memory_order_release);
+                }
+        } while (!quit);
+
+        return NULL;
+}
+
+/* Creates the --record file with the asciicast header for the ANSI
+ * backend's screen, and starts its writer. The ring is in place and
+ * paged in before the first frame, which starts from a blank screen. */
+void record_open(void) {
+        char *term = getenv("TERM");
+        char header[256];
+        int len;
+
+        /* A pipe's reader going away ends the recording only. */
+        signal(SIGPIPE, SIG_IGN);
+
+        ttyclock->record.fd = open(ttyclock->record.path,
+                                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                   0644);
+        if (ttyclock->record.fd == -1) {
+                end_screen();
+                perror(ttyclock->record.path);
+                exit(EXIT_FAILURE);
+        }
+
+        len = snprintf(header, sizeof(header),
+                       "{\"version\": 2, \"width\": %d, \"height\": %d, "
+                       "\"timestamp\": %lld, \"env\": {\"TERM\": \"",
+                       ttyclock->ansi.cols, ttyclock->ansi.rows,
+                       (long long)time(NULL));
+        len += json_escape(header + len, term ? term : "");
+        len += snprintf(header + len, sizeof(header) - len, "\"}}\n");
+        if (write(ttyclock->record.fd, header, len) != len) {
+                end_screen();
+                perror(ttyclock->record.path);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->record.ring = malloc(RECORD_RING);
+        assert(ttyclock->record.ring != NULL);
+        memset(ttyclock->record.ring, 0, RECORD_RING);
+
+        ttyclock->record.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ttyclock->record.evfd == -1
+            || pthread_create(&ttyclock->record.thread, NULL,
+                              record_writer, NULL)) {
+                end_screen();
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        clock_now(&ttyclock->record.start);
+        ttyclock->record.at = ttyclock->record.start;
+        ansi_repaint(True);
+}
+
+/* Stops the --record writer once it has written every frame. */
+void record_stop(void) {
+        if (!ttyclock->record.ring) return;
+
+        atomic_store(&ttyclock->record.quit, True);
+        efd_wake(ttyclock->record.evfd);
+        pthread_join(ttyclock->record.thread, NULL);
+        close(ttyclock->record.fd);
+}
+
+/* Decodes the JSON string at s, just past its opening quote, in place
+ * and ended with a NUL, and leaves *end just past its closing quote.
+ * Returns its length, or -1 if it doesn't end on the line. */
+static long json_unescape(char *s, char **end) {
+        char *in = s, *out = s, *hex;
+        unsigned long u;
+
+        while (*in != '"') {
+                if (*in == '\0' || *in == '\n') return -1;
+                if (*in != '\\') {
+                        *out++ = *in++;
+                        continue;
+                }
+
+                switch (*++in) {
+                case 'b': *out++ = '\b'; break;
+                case 'f': *out++ = '\f'; break;
+                case 'n': *out++ = '\n'; break;
+                case 'r': *out++ = '\r'; break;
+                case 't': *out++ = '\t'; break;
+                case 'u':
+                        u = strtoul(in + 1, &hex, 16);
+                        if (hex != in + 5) return -1;
+                        in += 4;
+                        /* As UTF-8; a surrogate pair is not put together. */
+                        if (u < 0x80) {
+                                *out++ = u;
+                        } else if (u < 0x800) {
+                                *out++ = 0xc0 | u >> 6;
+                                *out++ = 0x80 | (u & 0x3f);
+                        } else {
+                                *out++ = 0xe0 | u >> 12;
+                                *out++ = 0x80 | (u >> 6 & 0x3f);
+                                *out++ = 0x80 | (u & 0x3f);
+                        }
+                        break;
+                case '\0':
+                        return -1;
+                default:
+                        *out++ = *in;
+                        break;
+                }
+                ++in;
+        }
+
+        /* No longer than it was, so this is at most the quote. */
+        *out = '\0';
+        *end = in + 1;
+        return out - s;
+}
+
+/* Parses an asciicast event, [time, "type", "data"], in place. Returns
+ * the data's length, with its time in *at and its type and data in
+ * *type and *data, or -1 for a line that isn't an event. */
+static long replay_event(char *line, double *at, char **type, char **data) {
+        char *p = line;
+
+        if (*p++ != '[') return -1;
+        *at = strtod(p, &p);
+        while (*p == ' ' || *p == ',') ++p;
+        if (*p++ != '"') return -1;
+        *type = p;
+        if (json_unescape(p, &p) < 0) return -1;
+        while (*p == ' ' || *p == ',') ++p;
+        if (*p++ != '"') return -1;
+        *data = p;
+
+        return json_unescape(p, &p);
+}
+
+/* Plays the asciicast at path back on stdout, at speed times the pace
+ * it was recorded at, or as fast as it can be written for 0. Each frame
+ * is due at its time from the start, so a slow terminal doesn't make
+ * the rest late. Events other than output are skipped. */
+static int replay(const char *path, double speed) {
+        static const char leave[] = "\033[0m\033(B\033[?25h\n";
+        FILE *f = fopen(path, "r");
+        struct timespec start, due;
+        unsigned long line = 1;
+        char *buf = NULL, *type, *data;
+        size_t cap = 0, done;
+        double at;
+        long len;
+        ssize_t n;
+
+        if (!f) {
+                perror(path);
+                return EXIT_FAILURE;
+        }
+        if (getline(&buf, &cap, f) == -1 || !strstr(buf, "\"version\": 2")) {
+                printf("%s: not an asciicast v2 recording\n", path);
+                return EXIT_FAILURE;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (getline(&buf, &cap, f) != -1) {
+                ++line;
+                if ((len = replay_event(buf, &at, &type, &data)) < 0) {
+                        printf("%s:%lu: not an asciicast event\n", path, line);
+                        return EXIT_FAILURE;
+                }
+                if (strcmp(type, "o")) continue;
+
+                if (speed > 0) {
+                        due = start;
+                        ts_add_ns(&due, at / speed * NSEC_PER_SEC);
+                        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                               &due, NULL) == EINTR);
+                }
+
+                for (done = 0; done < (size_t)len; done += n) {
+                        n = write(STDOUT_FILENO, data + done, len - done);
+                        if (n < 0 && errno == EINTR) n = 0;
+                        else if (n <= 0) return EXIT_FAILURE;
+                }
+        }
+
+        free(buf);
+        fclose(f);
+
+        return write(STDOUT_FILENO, leave, sizeof(leave) - 1) < 0
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Fills two elements from digits into time, handling the -1 case. */
+static void fill_ttyclock_time(int *digits, unsigned int *time) {
+        if (digits[1] == -1) {
+                time[0] = 0;
+                if (digits[0] == -1) time[1] = 0;
+                else time[1] = digits[0];
+        } else {
+                time[0] = digits[0];
+                time[1] = digits[1];
+        }
+}
+
+
+/* Writes a bell or escape sequence to the terminal from the worker, in
+ * one write() so it can't land inside a sequence of the main loop's. */
+static void alarm_write(const char *s) {
+        if (write(ttyclock->ttyfd, s, strlen(s)) < 0) return;
+}
+
+/* Plays one step of the alarm pattern. A silence, bell or flash ends
+ * as soon as the alarm is stopped; a toot plays out. */
+static void alarm_play(const alarm_step_t *step) {
+        if (step->hz == 0) {
+                efd_wait(ttyclock->alarm.evfd, step->ms);
+                return;
+        }
+
+        switch (ttyclock->alarm.kind) {
+        case ALARM_TOOT:
+                #ifdef TOOT
+                toot(step->hz, step->ms);
+                break;
+                #endif
+                /* Without toot, ring the bell instead. */
+        case ALARM_BELL:
+                alarm_write("\a");
+                efd_wait(ttyclock->alarm.evfd, step->ms);
+                break;
+        case ALARM_FLASH:
+                alarm_write("\033[?5h");
+                efd_wait(ttyclock->alarm.evfd, step->ms);
+                alarm_write("\033[?5l");
+                break;
+        case ALARM_OFF:
+                break;
+        }
+}
+
+/* Plays the alarm pattern whenever and for as long as it rings, up to
+ * its number of repeats. Only this thread blocks on the sound, so keys
+ * and ticks are handled while it plays. */
+static void *alarm_worker(void *arg) {
+        int r, i;
+
+        (void)arg;
+
+        while (!atomic_load(&ttyclock->alarm.quit)) {
+                if (!atomic_load(&ttyclock->alarm.ring)) {
+                        efd_wait(ttyclock->alarm.evfd, -1);
+                        continue;
+                }
+
+                for (r = 0; ttyclock->alarm.repeats == 0
+                            || r < ttyclock->alarm.repeats; ++r) {
+                        for (i = 0; i < ttyclock->alarm.nsteps
+                                    && atomic_load(&ttyclock->alarm.ring); ++i)
+                                alarm_play(&ttyclock->alarm.step[i]);
+                        if (!atomic_load(&ttyclock->alarm.ring)) break;
+                }
+
+                /* Played out: keep quiet until stopped and rung again. */
+                while (atomic_load(&ttyclock->alarm.ring)
+                       && !atomic_load(&ttyclock->alarm.quit))
+                        efd_wait(ttyclock->alarm.evfd, -1);
+        }
+
+        return NULL;
+}
+
+/* Starts the alarm worker. */
+static void alarm_start(void) {
+        if (ttyclock->alarm.kind == ALARM_OFF) return;
+
+        ttyclock->alarm.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ttyclock->alarm.evfd == -1
+            || pthread_create(&ttyclock->alarm.thread, NULL,
+                              alarm_worker, NULL)) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->alarm.started = True;
+}
+
+/* Rings the alarm while a running timer is at zero, and stops it once
+ * none is. */
+static void alarm_update(void) {
+        struct timespec now;
+        Bool ring = False;
+        countdown_t *t;
+
+        if (!ttyclock->alarm.started) return;
+
+        clock_now(&now);
+        for (t = ttyclock->timer; t < ttyclock->timer + ttyclock->ntimers; ++t) {
+                if (!t->paused && !t->up
+                    && ts_diff_ns(&t->deadline, &now) <= 0) {
+                        ring = True;
+                        break;
+                }
+        }
+
+        if (atomic_exchange(&ttyclock->alarm.ring, ring) != ring)
+                efd_wake(ttyclock->alarm.evfd);
+}
+
+/* Stops the alarm worker. A toot can't be cut short, so one that is
+ * playing is left to the exit rather than waited for. */
+static void alarm_stop(void) {
+        if (!ttyclock->alarm.started) return;
+
+        atomic_store(&ttyclock->alarm.ring, False);
+        atomic_store(&ttyclock->alarm.quit, True);
+        efd_wake(ttyclock->alarm.evfd);
+
+        #ifdef TOOT
+        if (ttyclock->alarm.kind == ALARM_TOOT) return;
+        #endif
+
+        pthread_join(ttyclock->alarm.thread, NULL);
+}
+
+/* Takes a lap of stopwatch t, if it is running, and hands it to the
+ * --laps writer. Only stores into the ring, allocated and touched up
+ * front, and wakes the writer once per LAP_BATCH laps, so a lap costs
+ * the same however many came before. With the ring full, the lap is
+ * dropped and counted rather than waited for. The split is put into
+ * words with the next frame (see lap_show()). */
+void lap_take(countdown_t *t) {
+        struct timespec now, real;
+        long long split;
+        uint64_t head;
+        lap_t *lap;
+
+        clock_now(&now);
+        clock_gettime(CLOCK_REALTIME, &real);
+        if (!t->up || t->paused) return;
+
+        ++t->laps;
+        split = ts_diff_ns(&now, &t->deadline) - t->lap_ns;
+        t->lap_ns += split;
+        t->lap_split = split;
+        t->dirty = True;
+
+        if (ttyclock->lap.ring) {
+                /* The writer's tail is only read again once the ring
+                 * looks full. */
+                head = atomic_load_explicit(&ttyclock->lap.head,
+                                            memory_order_relaxed);
+                if (head - ttyclock->lap.tail_seen == LAP_RING)
+                        ttyclock->lap.tail_seen = atomic_load_explicit(
+                                &ttyclock->lap.tail, memory_order_acquire);
+                if (head - ttyclock->lap.tail_seen == LAP_RING) {
+                        ++ttyclock->lap.dropped;
+                } else {
+                        lap = &ttyclock->lap.ring[head % LAP_RING];
+                        lap->stamp_ns = real.tv_sec * NSEC_PER_SEC
+                                        + real.tv_nsec;
+                        lap->elapsed_ns = t->lap_ns;
+                        lap->split_ns = split;
+                        lap->timer = t - ttyclock->timer;
+                        lap->n = t->laps;
+                        atomic_store_explicit(&ttyclock->lap.head, head + 1,
+                                              memory_order_release);
+                        if ((head + 1) % LAP_BATCH == 0)
+                                efd_wake(ttyclock->lap.evfd);
+                }
+        }
+}
+
+/* Writes the laps in the ring to the --laps file, a line each: timer,
+ * lap, seconds on the stopwatch, split, and the wall-clock time taken.
+ * Wakes for a batch or every LAP_FLUSH_MS, and drains the ring before
+ * it quits. */
+static void *lap_writer(void *arg) {
+        char buf[LAP_BATCH * 96];
+        uint64_t head, tail;
+        const lap_t *lap;
+        size_t len;
+        Bool quit;
+
+        (void)arg;
+
+        do {
+                quit = atomic_load(&ttyclock->lap.quit);
+                if (!quit) efd_wait(ttyclock->lap.evfd, LAP_FLUSH_MS);
+
+                tail = atomic_load_explicit(&ttyclock->lap.tail,
+                                            memory_order_relaxed);
+                head = atomic_load_explicit(&ttyclock->lap.head,
+                                            memory_order_acquire);
+                while (tail != head) {
+                        for (len = 0; tail != head
+                                      && len + 96 <= sizeof(buf); ++tail) {
+                                lap = &ttyclock->lap.ring[tail % LAP_RING];
+                                len += sprintf(buf + len,
+                                               "%u %u %lld.%09lld %lld.%09lld "
+                                               "%lld.%09lld\n",
+                                               lap->timer, lap->n,
+                                               (long long)(lap->elapsed_ns / NSEC_PER_SEC),
+                                               (long long)(lap->elapsed_ns % NSEC_PER_SEC),
+                                               (long long)(lap->split_ns / NSEC_PER_SEC),
+                                               (long long)(lap->split_ns % NSEC_PER_SEC),
+                                               (long long)(lap->stamp_ns / NSEC_PER_SEC),
+                                               (long long)(lap->stamp_ns % NSEC_PER_SEC));
+                        }
+                        /* The slots are free once formatted. */
+                        atomic_store_explicit(&ttyclock->lap.tail, tail,
+                                              memory_order_release);
+                        if (write(ttyclock->lap.fd, buf, len) < 0) break;
+                }
+        } while (!quit);
+
+        return NULL;
+}
+
+/* Opens the --laps file and starts its writer, with the ring in place
+ * and paged in before the first lap. */
+void lap_open(void) {
+        size_t size = LAP_RING * sizeof(lap_t);
+
+        ttyclock->lap.fd = open(ttyclock->lap.path,
+                                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                0644);
+        if (ttyclock->lap.fd == -1) {
+                perror(ttyclock->lap.path);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->lap.ring = malloc(size);
+        assert(ttyclock->lap.ring != NULL);
+        memset(ttyclock->lap.ring, 0, size);
+
+        ttyclock->lap.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ttyclock->lap.evfd == -1
+            || pthread_create(&ttyclock->lap.thread, NULL, lap_writer, NULL)) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* Stops the --laps writer once it has written every lap taken. */
+void lap_stop(void) {
+        if (!ttyclock->lap.ring) return;
+
+        atomic_store(&ttyclock->lap.quit, True);
+        efd_wake(ttyclock->lap.evfd);
+        pthread_join(ttyclock->lap.thread, NULL);
+        close(ttyclock->lap.fd);
+}
+
+/* Sets up how --hook commands start: with no signals blocked or
+ * ignored, in a process group of their own, out of reach of the
+ * terminal's keys, and with /dev/null for stdin, stdout and stderr, as
+ * the terminal is drawn on. */
+void hook_init(void) {
+        posix_spawnattr_t *attr = &ttyclock->hooks.attr;
+        posix_spawn_file_actions_t *actions = &ttyclock->hooks.actions;
+        sigset_t set;
+
+        posix_spawnattr_init(attr);
+        posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGMASK
+                                       | POSIX_SPAWN_SETSIGDEF
+                                       | POSIX_SPAWN_SETPGROUP);
+        sigemptyset(&set);
+        posix_spawnattr_setsigmask(attr, &set);
+        sigaddset(&set, SIGPIPE);
+        posix_spawnattr_setsigdefault(attr, &set);
+        posix_spawnattr_setpgroup(attr, 0);
+
+        posix_spawn_file_actions_init(actions);
+        posix_spawn_file_actions_addopen(actions, STDIN_FILENO, "/dev/null",
+                                         O_RDWR, 0);
+        posix_spawn_file_actions_adddup2(actions, STDIN_FILENO, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(actions, STDIN_FILENO, STDERR_FILENO);
+}
+
+/* Starts hook i for timer t, which the command finds in TTYTIMER_TIMER,
+ * TTYTIMER_LABEL and TTYTIMER_AT (seconds left) in its environment.
+ * posix_spawn() returns as soon as the child runs; it is reaped when
+ * it exits (see hook_reap()). With --hook-max commands still running,
+ * the hook is skipped instead. */
+void hook_spawn(countdown_t *t, int i) {
+        char timer[32], label[LABELMAX + 32], at[32];
+        char *argv[] = { "/bin/sh", "-c",
+                         (char *)ttyclock->hooks.hook[i].cmd, NULL };
+        int len = strlen(t->date.timestr) - (sizeof(" hh:mm:ss") - 1);
+        struct timespec start, end;
+        size_t n = 0;
+        char **env;
+        pid_t pid;
+        int err;
+
+        if (ttyclock->hooks.running == ttyclock->hooks.max) {
+                ++ttyclock->hooks.skipped;
+                return;
+        }
+
+        /* Ahead of any inherited values, so they are the ones found. */
+        while (environ[n]) ++n;
+        env = malloc((n + 4) * sizeof(*env));
+        assert(env != NULL);
+        snprintf(timer, sizeof(timer), "TTYTIMER_TIMER=%d",
+                 (int)(t - ttyclock->timer));
+        snprintf(label, sizeof(label), "TTYTIMER_LABEL=%.*s",
+                 len > 0 ? len : 0, t->date.timestr);
+        snprintf(at, sizeof(at), "TTYTIMER_AT=%lld",
+                 ttyclock->hooks.hook[i].at / NSEC_PER_SEC);
+        env[0] = timer;
+        env[1] = label;
+        env[2] = at;
+        memcpy(env + 3, environ, (n + 1) * sizeof(*env));
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        err = posix_spawn(&pid, argv[0], &ttyclock->hooks.actions,
+                          &ttyclock->hooks.attr, argv, env);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free(env);
+
+        if (ttyclock->option.stats)
+                hist_add(&ttyclock->stats.spawn, ts_diff_ns(&end, &start));
+
+        if (err) {
+                ++ttyclock->hooks.failed;
+                return;
+        }
+        ttyclock->hooks.pid[ttyclock->hooks.running++] = pid;
+        ++ttyclock->hooks.started;
+}
+
+/* Starts the hooks that came due. The main loop calls this once the
+ * frame of the tick they came due at is out. */
+static void hook_run(void) {
+        countdown_t *t;
+        int i;
+
+        ttyclock->hooks.due = False;
+
+        for (t = ttyclock->timer; t < ttyclock->timer + ttyclock->ntimers; ++t)
+                for (i = 0; t->hooks_due; ++i) {
+                        if (!(t->hooks_due & 1u << i)) continue;
+                        t->hooks_due &= ~(1u << i);
+                        hook_spawn(t, i);
+                }
+}
+
+/* Reaps the hooks that exited, counting those that failed. Only the
+ * hooks' own pids are waited for, so no other child is reaped. */
+static void hook_reap(void) {
+        int i, status;
+        pid_t r;
+
+        ttyclock->hooks.reap = False;
+
+        for (i = ttyclock->hooks.running - 1; i >= 0; --i) {
+                if ((r = waitpid(ttyclock->hooks.pid[i], &status, WNOHANG)) == 0)
+                        continue;
+                if (r > 0 && (!WIFEXITED(status) || WEXITSTATUS(status)))
+                        ++ttyclock->hooks.failed;
+                ttyclock->hooks.pid[i] =
+                        ttyclock->hooks.pid[--ttyclock->hooks.running];
+        }
+}
+
+/* Moves the --program timer t on to the segments that start by now.
+ * Each deadline is the one before plus the new duration, so segments
+ * follow each other without gaps or drift, however late the tick. */
+static void program_advance(countdown_t *t, const struct timespec *now) {
+        while (ts_diff_ns(&t->deadline, now) <= 0 && program_next(t)) {
+                ts_add_ns(&t->deadline, t->duration * NSEC_PER_SEC);
+                state_save(t);
+        }
+}
+
+/* Ticks every timer that is due by the clock, recording how late each
+ * tick was. Ticks missed while busy are skipped, not replayed. */
+static void run_ticks(void) {
+        struct timespec now;
+        long long late;
+        countdown_t *t;
+
+        clock_now(&now);
+
+        while (ttyclock->heapn > 0
+               && (late = ts_diff_ns(&now, &ttyclock->heap[0]->next_tick)) >= 0) {
+                t = ttyclock->heap[0];
+
+                ++ttyclock->drift.ticks;
+                ttyclock->drift.total_ns += late;
+                if (late > ttyclock->drift.max_ns) ttyclock->drift.max_ns = late;
+                if (ttyclock->option.stats) hist_add(&ttyclock->stats.late, late);
+
+                if (t - ttyclock->timer == ttyclock->program.timer)
+                        program_advance(t, &now);
+
+                schedule_tick(t, &now);
+                t->dirty = True;
+                heap_down(0);
+        }
+
+        arm_tick();
+}
+
+/* Consumes the tick timer and runs the ticks that are due. */
+void handle_tick(void) {
+        uint64_t expirations;
+
+        if (read(ttyclock->timerfd, &expirations, sizeof(expirations))
+            == sizeof(expirations))
+                run_ticks();
+}
+
+/* Moves the keys to the next timer. */
+static void select_next(void) {
+        ttyclock->selected = (ttyclock->selected + 1) % ttyclock->ntimers;
+}
+
+/* Has the --stats report written while the clock runs. The render
+ * thread writes it with the main thread's figures as they are now, so
+ * neither a terminal slow to take it nor a frame being drawn holds up
+ * the ticks and keys. */
+static void stats_dump(void) {
+        if (!ttyclock->option.stats) return;
+
+        if (!ttyclock->render.started) {
+                stats_take(&ttyclock->stats.taken);
+                stats_report(&ttyclock->stats.taken);
+                return;
+        }
+
+        pthread_mutex_lock(&ttyclock->stats.lock);
+        stats_take(&ttyclock->stats.taken);
+        pthread_mutex_unlock(&ttyclock->stats.lock);
+        ++ttyclock->render.want.dumps;
+}
+
+/* Writes the report stats_dump() asked for, between two frames. One on
+ * the terminal scribbles over the clock, so that is drawn again in
+ * full. */
+static void stats_write(void) {
+        static stats_main_t m;
+        int i;
+
+        pthread_mutex_lock(&ttyclock->stats.lock);
+        m = ttyclock->stats.taken;
+        pthread_mutex_unlock(&ttyclock->stats.lock);
+
+        stats_report(&m);
+        if (ttyclock->stats.path) return;
+
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_repaint(False);
+        } else {
+                clearok(curscr, True);
+        }
+        for (i = 0; i < ttyclock->ntimers; ++i)
+                invalidate_clock(&ttyclock->timer[i]);
+}
+
+/* Draws in colour c from now on. */
+static void recolor(int c) {
+        ttyclock->option.color = c;
+        build_glyphs();
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_repaint(False);
+        } else {
+                init_pair(1, ttyclock->bg, c);
+                init_pair(2, c, ttyclock->bg);
+                ttyclock->mirror.sync = True;
+        }
+}
+
+/* Copies the latest snapshot of publish_timers() to render.read and v.
+ * The reader's half of the seqlock: a copy that a write overlapped is
+ * taken again. */
+static void render_read(view_t *v) {
+        unsigned long seq;
+
+        do {
+                while ((seq = atomic_load_explicit(&ttyclock->render.seq,
+                                                   memory_order_acquire)) & 1)
+                        sched_yield();
+                memcpy(ttyclock->render.read, ttyclock->render.timer,
+                       ttyclock->render.n * sizeof(shown_t));
+                *v = ttyclock->render.pub;
+                atomic_thread_fence(memory_order_acquire);
+        } while (atomic_load_explicit(&ttyclock->render.seq,
+                                      memory_order_relaxed) != seq);
+}
+
+/* Draws what changed in the latest snapshot, and sends it to the
+ * terminal in a single update. Snapshots published while the last frame
+ * was being written are skipped rather than drawn one by one. */
+void render_frame(void) {
+        unsigned long cells = ttyclock->drawn.cells;
+        unsigned long refreshes = ttyclock->stats.refreshes, bytes;
+        struct timespec start, end;
+        view_t v, *cur = &ttyclock->render.cur;
+        shown_t *s;
+        countdown_t *t;
+        int i;
+
+        render_read(&v);
+        ttyclock->record.at = v.at;
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                t = &ttyclock->timer[i];
+                s = &ttyclock->render.read[i];
+                if (!memcmp(s, &t->shown, sizeof(*s))) continue;
+
+                /* The date window has to fit a new label or lap. */
+                if (strcmp(s->date.timestr, t->shown.date.timestr)) {
+                        t->drawn.date = False;
+                        if (strlen(s->date.timestr)
+                            != strlen(t->shown.date.timestr))
+                                ttyclock->relayout = True;
+                }
+                memcpy(&t->shown, s, sizeof(*s));
+                t->redraw = True;
+        }
+
+        if (v.resizes != cur->resizes) resize_clock();
+        if (v.color != cur->color) recolor(v.color);
+        if (v.selected != cur->selected) {
+                for (i = 0; i < 2; ++i) {
+                        t = &ttyclock->timer[i ? v.selected : cur->selected];
+                        t->drawn.date = False;
+                        t->redraw = True;
+                }
+        }
+        i = v.dumps != cur->dumps;
+        *cur = v;
+        if (i) stats_write();
+
+        if (ttyclock->relayout) {
+                ttyclock->relayout = False;
+                set_center();
+        }
+
+        /* A timer that went coarse or back resizes, and moves the others. */
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                t = &ttyclock->timer[i];
+                if (t->geo.w != frame_width(t)) set_second(t);
+        }
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                t = &ttyclock->timer[i];
+                if (!t->redraw || t->hidden) continue;
+
+                if (ttyclock->option.stats) {
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_clock(t);
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        hist_add(&ttyclock->stats.draw,
+                                 ts_diff_ns(&end, &start));
+                } else {
+                        draw_clock(t);
+                }
+                t->redraw = False;
+        }
+
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_flush();
+        } else {
+                doupdate();
+                ++ttyclock->stats.refreshes;
+                mirror_update();
+        }
+
+        if (ttyclock->option.stats) {
+                bytes = tty_bytes();
+                hist_add(&ttyclock->stats.tty, bytes - ttyclock->stats.bytes);
+                ttyclock->stats.written += bytes - ttyclock->stats.bytes;
+                ttyclock->stats.bytes = bytes;
+                hist_add(&ttyclock->stats.refresh,
+                         ttyclock->stats.refreshes - refreshes);
+        }
+
+        cells = ttyclock->drawn.cells - cells;
+        if (cells > ttyclock->drawn.max_cells) ttyclock->drawn.max_cells = cells;
+        ++ttyclock->drawn.frames;
+        startup_mark(START_FRAME);
+}
+
+/* Draws a frame whenever woken, until told to quit. A terminal that
+ * doesn't read only holds up this thread. */
+static void *render_worker(void *arg) {
+        (void)arg;
+
+        /* Count this thread's bytes from now on (see tty_bytes()). */
+        if (ttyclock->option.stats
+            && ttyclock->option.backend == BACKEND_CURSES) {
+                close(ttyclock->stats.iofd);
+                ttyclock->stats.iofd = open("/proc/thread-self/io",
+                                            O_RDONLY | O_CLOEXEC);
+                ttyclock->stats.bytes = tty_bytes();
+        }
+
+        while (!atomic_load(&ttyclock->render.quit)) {
+                if (efd_wait(ttyclock->render.evfd, -1)
+                    && !atomic_load(&ttyclock->render.quit))
+                        render_frame();
+        }
+
+        return NULL;
+}
+
+/* Hands the screen over to the render thread. Only it draws from now
+ * on, until render_stop(). */
+void render_start(void) {
+        ttyclock->render.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ttyclock->render.evfd == -1
+            || pthread_create(&ttyclock->render.thread, NULL,
+                              render_worker, NULL)) {
+                end_screen();
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->render.started = True;
+}
+
+/* Waits for the render thread's frame to end, and stops it. */
+void render_stop(void) {
+        if (!ttyclock->render.started) return;
+
+        atomic_store(&ttyclock->render.quit, True);
+        efd_wake(ttyclock->render.evfd);
+        pthread_join(ttyclock->render.thread, NULL);
+        close(ttyclock->render.evfd);
+        ttyclock->render.started = False;
+}
+
+/* Returns the next key waiting on stdin, or ERR. Not wgetch(), even
+ * with ncurses: that refreshes stdscr, and only the render thread may. */
+static int read_key(void) {
+        struct pollfd fds[1] = {
+                { .fd = STDIN_FILENO, .events = POLLIN },
+        };
+        unsigned char c;
+
+        /* ncurses leaves the terminal blocking until a key. */
+        if (ttyclock->option.backend == BACKEND_CURSES && poll(fds, 1, 0) != 1)
+                return ERR;
+
+        return read(STDIN_FILENO, &c, 1) == 1 ? c : ERR;
+}
+
+/* Handles every key waiting on stdin. */
+void key_event(void) {
+        struct timespec now;
+        countdown_t *t;
+        int i, c;
+
+        while ((c = read_key()) != ERR) {
+                t = &ttyclock->timer[ttyclock->selected];
+
+                switch(c) {
+                case 'q':
+                case 'Q':
+                        ttyclock->running = False;
+                        break;
+
+                case 'r':
+                case 'R':
+                        clock_now(&now);
+                        start_timer(t, &now);
+                        arm_tick();
+                        break;
+
+                case 'p':
+                case 'P':
+                case ' ':
+                        pause_timer(t);
+                        break;
+
+                case '\t':
+                case 'n':
+                case 'N':
+                        select_next();
+                        break;
+
+                case 's':
+                case 'S':
+                        ttyclock->stats.dump = True;
+                        break;
+
+                case 'l':
+                case 'L':
+                        lap_take(t);
+                        break;
+
+                default:
+                        for (i = 0; i < 8; ++i) {
+                                if (c != (i + '0')) continue;
+
+                                ttyclock->render.want.color = i;
+                        }
+
+                        break;
+                }
+        }
+}
+
+/* Control socket. Scripts and status bars send it one command a line,
+ * and get a reply for each (see ctl_command()). It is served from the
+ * main loop between ticks, without ever blocking on a client. */
+
+/* Connects to the control socket at path. Returns the socket, or -1. */
+int ctl_connect(const char *path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        int fd;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/* Starts listening on the control socket. One left behind by a killed
+ * process is replaced, one still in use isn't. */
+void ctl_open(void) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        const char *path = ttyclock->ctl.path;
+        Bool bound;
+        int fd, live;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr, "%s: socket path too long\n", path);
+                exit(EXIT_FAILURE);
+        }
+        strcpy(addr.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+
+        bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (!bound && errno == EADDRINUSE) {
+                if ((live = ctl_connect(path)) != -1) {
+                        close(live);
+                        fprintf(stderr, "%s: in use by another ttytimer\n",
+                                path);
+                        exit(EXIT_FAILURE);
+                }
+                unlink(path);
+                bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        }
+
+        if (!bound || listen(fd, SOMAXCONN) == -1) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->ctl.fd = fd;
+}
+
+/* Moves the time left on t by ns, which may be negative. A stopwatch
+ * is moved the other way, but not below zero either. Returns False,
+ * leaving t alone, if a countdown would show 100 hours or more. */
+static Bool add_time(countdown_t *t, long long ns) {
+        struct timespec now;
+
+        if (t->up) ns = -ns;
+
+        clock_now(&now);
+        if (!t->up && (t->paused ? t->left_ns
+                       : ts_diff_ns(&t->deadline, &now)) + ns
+                      > (100 * 3600 - 1) * NSEC_PER_SEC)
+                return False;
+
+        if (t->paused) {
+                t->left_ns += ns;
+                if (t->up ? t->left_ns > 0 : t->left_ns < 0) t->left_ns = 0;
+        } else {
+                ts_add_ns(&t->deadline, ns);
+                ns = ts_diff_ns(&t->deadline, &now);
+                if (t->up ? ns > 0 : ns < 0) t->deadline = now;
+
+                schedule_tick(t, &now);
+                heap_update(t);
+                arm_tick();
+        }
+
+        t->dirty = True;
+        state_save(t);
+
+        return True;
+}
+
+/* Runs one control command, writing the reply to out:
+ *
+ *   status        a line per timer: index, running|paused|done, seconds
+ *                 left and the timer's label and time
+ *   pause [n]     pause timer n, the selected one if not given
+ *   resume [n]    resume it
+ *   reset [n]     restart it
+ *   add secs [n]  add secs seconds to it, or take them off if negative
+ *   lap [n]       take a lap of it, a stopwatch
+ *   quit          quit ttytimer
+ */
+static void ctl_command(char *line, FILE *out) {
+        char *save, *cmd, *arg, *end;
+        struct timespec now;
+        countdown_t *t;
+        long long left;
+        double secs = 0;
+        long n;
+        int i;
+
+        cmd = strtok_r(line, " \t\r", &save);
+        if (!cmd) cmd = "";
+
+        if (strcmp(cmd, "status") == 0) {
+                clock_now(&now);
+                for (i = 0; i < ttyclock->ntimers; ++i) {
+                        t = &ttyclock->timer[i];
+                        left = t->paused ? t->left_ns
+                                         : ts_diff_ns(&t->deadline, &now);
+                        if (left < 0 && !t->up) left = 0;
+
+                        /* A stopwatch's time is negative, as it has run
+                         * that long past its deadline. */
+                        fprintf(out, "%d %s %s%lld.%03lld %s\n", i,
+                                t->paused ? "paused"
+                                : left || t->up ? "running" : "done",
+                                left < 0 ? "-" : "",
+                                llabs(left) / NSEC_PER_SEC,
+                                llabs(left) % NSEC_PER_SEC / 1000000,
+                                t->date.timestr);
+                }
+                return;
+        }
+
+        if (strcmp(cmd, "quit") == 0) {
+                ttyclock->running = False;
+                fputs("ok\n", out);
+                return;
+        }
+
+        if (strcmp(cmd, "add") == 0) {
+                arg = strtok_r(NULL, " \t\r", &save);
+                secs = arg ? strtod(arg, &end) : 0;
+                /* NaN fails the range too, so secs * NSEC_PER_SEC
+                 * below can't overflow. */
+                if (!arg || *end
+                    || !(secs > -100 * 3600 && secs < 100 * 3600)) {
+                        fputs("error: add takes seconds, under 100 hours\n",
+                              out);
+                        return;
+                }
+        }
+
+        /* The rest act on one timer. */
+        n = ttyclock->selected;
+        if ((arg = strtok_r(NULL, " \t\r", &save)) != NULL) {
+                n = strtol(arg, &end, 10);
+                if (*end || n < 0 || n >= ttyclock->ntimers) {
+                        fprintf(out, "error: no timer %s\n", arg);
+                        return;
+                }
+        }
+        t = &ttyclock->timer[n];
+
+        if (strcmp(cmd, "pause") == 0) {
+                if (!t->paused) pause_timer(t);
+        } else if (strcmp(cmd, "resume") == 0) {
+                if (t->paused) pause_timer(t);
+        } else if (strcmp(cmd, "reset") == 0) {
+                clock_now(&now);
+                start_timer(t, &now);
+                arm_tick();
+        } else if (strcmp(cmd, "add") == 0) {
+                if (!add_time(t, secs * NSEC_PER_SEC)) {
+                        fprintf(out, "error: timer %ld would show 100 hours "
+                                "or more\n", n);
+                        return;
+                }
+        } else if (strcmp(cmd, "lap") == 0) {
+                if (!t->up) {
+                        fprintf(out, "error: timer %ld is no stopwatch\n", n);
+                        return;
+                }
+                lap_take(t);
+        } else {
+                fprintf(out, "error: unknown command %s\n", cmd);
+                return;
+        }
+
+        fputs("ok\n", out);
+}
+
+/* Drops control client i. */
+static void ctl_drop(int i) {
+        close(ttyclock->ctl.client[i].fd);
+        free(ttyclock->ctl.client[i].reply);
+        ttyclock->ctl.client[i] = ttyclock->ctl.client[--ttyclock->ctl.nclients];
+}
+
+/* Sends control client i as much of its replies as it takes now. The
+ * rest waits for it to take more (see wait_event()). */
+static void ctl_flush(int i) {
+        char *reply = ttyclock->ctl.client[i].reply;
+        size_t *sent = &ttyclock->ctl.client[i].sent;
+        size_t len = ttyclock->ctl.client[i].replylen;
+        ssize_t n;
+
+        n = send(ttyclock->ctl.client[i].fd, reply + *sent, len - *sent,
+                 MSG_NOSIGNAL);
+        if (n == -1) {
+                if (errno != EAGAIN) ctl_drop(i);
+                return;
+        }
+
+        *sent += n;
+        if (*sent == len) {
+                free(reply);
+                ttyclock->ctl.client[i].reply = NULL;
+                ttyclock->ctl.client[i].replylen = 0;
+        }
+}
+
+/* Takes every connection waiting on the control socket. */
+static void ctl_accept(void) {
+        int fd;
+
+        while ((fd = accept4(ttyclock->ctl.fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                if (ttyclock->ctl.nclients == MAX_CTL_CLIENTS) {
+                        close(fd);
+                        continue;
+                }
+
+                memset(&ttyclock->ctl.client[ttyclock->ctl.nclients], 0,
+                       sizeof(ttyclock->ctl.client[0]));
+                ttyclock->ctl.client[ttyclock->ctl.nclients++].fd = fd;
+        }
+}
+
+/* Answers the commands control client i has sent, or sends it the rest
+ * of the replies it hasn't taken yet. A client that hangs up or sends
+ * a line that is too long is dropped. */
+static void ctl_serve(int i) {
+        char *buf = ttyclock->ctl.client[i].buf, *nl, *reply = NULL;
+        size_t *len = &ttyclock->ctl.client[i].len, replylen = 0;
+        FILE *out;
+        ssize_t n;
+
+        /* No more commands are read until it has taken the replies. */
+        if (ttyclock->ctl.client[i].replylen) {
+                ctl_flush(i);
+                return;
+        }
+
+        n = read(ttyclock->ctl.client[i].fd, buf + *len, CTL_LINEMAX - *len);
+        if (n <= 0) {
+                if (n == 0 || errno != EAGAIN) ctl_drop(i);
+                return;
+        }
+        *len += n;
+
+        out = open_memstream(&reply, &replylen);
+        assert(out != NULL);
+
+        while ((nl = memchr(buf, '\n', *len)) != NULL) {
+                *nl = '\0';
+                ctl_command(buf, out);
+                ++ttyclock->ctl.requests;
+
+                *len -= nl + 1 - buf;
+                memmove(buf, nl + 1, *len);
+        }
+        fclose(out);
+
+        if (*len == CTL_LINEMAX) {
+                free(reply);
+                ctl_drop(i);
+                return;
+        }
+
+        if (!replylen) {
+                free(reply);
+                return;
+        }
+
+        ttyclock->ctl.client[i].reply = reply;
+        ttyclock->ctl.client[i].replylen = replylen;
+        ttyclock->ctl.client[i].sent = 0;
+        ctl_flush(i);
+}
+
+/* Sends a command to the ttytimer at the control socket path, and prints
+ * its reply. Returns the exit code. */
+static int ctl_client(const char *path, int argc, char **argv) {
+        char cmd[CTL_LINEMAX], buf[BUFSIZ];
+        size_t len = 0;
+        ssize_t n;
+        Bool error = False, first = True;
+        int fd, i;
+
+        for (i = 0; i < argc; ++i)
+                len += snprintf(cmd + len, len < sizeof(cmd) ? sizeof(cmd) - len : 0,
+                                "%s%s", i ? " " : "", argv[i]);
+        if (argc == 0) len = snprintf(cmd, sizeof(cmd), "status");
+        if (len + 1 >= sizeof(cmd)) {
+                fputs("Control command too long\n", stderr);
+                return EXIT_FAILURE;
+        }
+        cmd[len++] = '\n';
+
+        if ((fd = ctl_connect(path)) == -1) {
+                perror(path);
+                return EXIT_FAILURE;
+        }
+
+        if (write(fd, cmd, len) != (ssize_t)len) {
+                perror(path);
+                return EXIT_FAILURE;
+        }
+        shutdown(fd, SHUT_WR);
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                if (first && n >= 6 && strncmp(buf, "error:", 6) == 0)
+                        error = True;
+                first = False;
+                fwrite(buf, 1, n, stdout);
+        }
+        close(fd);
+
+        return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Handles the signals waiting on the signalfd. A storm of resizes only
+ * costs one relayout. */
+void handle_signals(void) {
+        struct signalfd_siginfo si;
+
+        while (read(ttyclock->sigfd, &si, sizeof(si)) == sizeof(si))
+                signal_handler(si.ssi_signo);
+
+        if (ttyclock->hooks.reap) hook_reap();
+
+        /* Only the frame after the last one has to be laid out again. */
+        if (ttyclock->resize) {
+                ttyclock->resize = False;
+                ++ttyclock->render.want.resizes;
+        }
+}
+
+/* Blocks until a tick, a key or a signal arrives, and handles it. */
+void wait_event(void) {
+        struct pollfd fds[4 + MAX_CTL_CLIENTS] = {
+                { .fd = STDIN_FILENO,       .events = POLLIN },
+                { .fd = ttyclock->timerfd,  .events = POLLIN },
+                { .fd = ttyclock->sigfd,    .events = POLLIN },
+                { .fd = ttyclock->ctl.fd,   .events = POLLIN },
+        };
+        int nclients = ttyclock->ctl.nclients, i, timeout = -1;
+        Bool coarse = ttyclock->heapn > 0 && ttyclock->heap[0]->coarse;
+        struct timespec start, end;
+        long long ns;
+
+        /* The frame is published by now, so a hook can't hold it up. */
+        if (ttyclock->hooks.due) hook_run();
+
+        for (i = 0; i < nclients; ++i) {
+                fds[4 + i].fd = ttyclock->ctl.client[i].fd;
+                fds[4 + i].events = ttyclock->ctl.client[i].replylen
+                                    ? POLLOUT : POLLIN;
+        }
+
+        /* --stream has no keys, but may wait for its reader to catch up. */
+        if (ttyclock->option.backend == BACKEND_STREAM) {
+                fds[0].fd = -1;
+                fds[0].events = POLLOUT;
+                if (ttyclock->stream.sent < ttyclock->stream.len)
+                        fds[0].fd = ttyclock->stream.fd;
+        }
+
+        /* A per-minute tick is a poll() timeout, which the kernel may
+         * put off by the --powersave timer slack (see arm_tick()). */
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (coarse) {
+                clock_now(&end);
+                ns = ts_diff_ns(&ttyclock->heap[0]->next_tick, &end);
+                timeout = ns <= 0 ? 0 : (ns + 999999) / 1000000;
+        }
+
+        if (poll(fds, 4 + nclients, timeout) == -1) return;
+        ++ttyclock->stats.wakeups;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ++ttyclock->stats.mode_wakeups[coarse];
+        ttyclock->stats.mode_ns[coarse] += ts_diff_ns(&end, &start);
+
+        if (fds[2].revents & POLLIN) handle_signals();
+
+        /* A per-minute tick is due by its timeout, but may come with
+         * a key or a signal rather than time out itself. */
+        if (fds[1].revents & POLLIN) handle_tick();
+        else if (coarse) run_ticks();
+
+        if (ttyclock->option.backend == BACKEND_STREAM) {
+                if (fds[0].revents) stream_flush();
+        } else if (fds[0].revents & POLLIN) {
+                if (ttyclock->option.stats)
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                key_event();
+                if (ttyclock->option.stats) {
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        hist_add(&ttyclock->stats.keys,
+                                 ts_diff_ns(&end, &start));
+                }
+        }
+        /* The terminal went away. */
+        else if (fds[0].revents & (POLLHUP | POLLERR))
+                ttyclock->running = False;
+
+        /* Backwards, as a dropped client's place goes to the last one. */
+        for (i = nclients - 1; i >= 0; --i)
+                if (fds[4 + i].revents) ctl_serve(i);
+
+        if (fds[3].revents & POLLIN) ctl_accept();
+
+        alarm_update();
+
+        /* Asked for by a key or SIGUSR1 */
+        if (ttyclock->stats.dump) {
+                ttyclock->stats.dump = False;
+                stats_dump();
+        }
+}
+
+/* Exits on a bad time argument, saying where in the --program it is. */
+static void bad_time(const char *msg) {
+        if (ttyclock->running) {
+                render_stop();
+                end_screen();
+        }
+        if (ttyclock->program.parsing)
+                printf("%s:%lu: ", ttyclock->program.path,
+                       ttyclock->program.line);
+        puts(msg);
+        exit(EXIT_FAILURE);
+}
+
+/* Parses time into t->date.hour/minute/second. Exits with an error
+ * message on bad time format. Sets timestr to what was parsed.
+ * time format: [label=]hh:mm:ss, where all but the colons are optional,
+ * or [label=]+ for a stopwatch.
+ */
+static void parse_time_arg(countdown_t *t, char *time) {
+        int digits[N_TIME_DIGITS];
+        char *label = NULL, *eq;
+        for (int i = 0; i < N_TIME_DIGITS; ++i) digits[i] = -1;
+
+        if ((eq = strchr(time, '=')) != NULL) {
+                *eq = '\0';
+                label = time;
+                time = eq + 1;
+
+                if (strlen(label) > LABELMAX) bad_time("Label too long");
+        }
+
+        /* A stopwatch shows its label, and its last lap after it. */
+        if (strcmp(time, "+") == 0) {
+                t->up = True;
+                t->duration = 0;
+                snprintf(t->date.timestr, sizeof(t->date.timestr), "%s",
+                         label ? label : "stopwatch");
+                t->labellen = strlen(t->date.timestr);
+                return;
+        }
+
+        int i = 0, remaining = 2;
+        while (*time != '\0') {
+                if (isdigit(*time)) {
+                        if (remaining == 0)
+                                bad_time("Too many digits in time argument");
+
+                        digits[i] = *time - '0';
+                        ++i;
+                        --remaining;
+                } else if (*time == ':') {
+                        i += remaining;
+                        remaining = 2;
+                } else {
+                        bad_time("Invalid character in time argument");
+                }
+
+                ++time;
+        }
+
+        fill_ttyclock_time(digits, t->date.hour);
+        fill_ttyclock_time(digits + 2, t->date.minute);
+        fill_ttyclock_time(digits + 4, t->date.second);
+        t->duration = (t->date.hour[0] * 10 + t->date.hour[1]) * 3600
+                      + (t->date.minute[0] * 10 + t->date.minute[1]) * 60
+                      + t->date.second[0] * 10 + t->date.second[1];
+
+        snprintf(t->date.timestr, sizeof(t->date.timestr),
+                 "%s%s%u%u:%u%u:%u%u",
+                 label ? label : "", label ? " " : "",
+                 t->date.hour[0], t->date.hour[1],
+                 t->date.minute[0], t->date.minute[1],
+                 t->date.second[0], t->date.second[1]);
+}
+
+/* Returns a new, zeroed timer at the end of ttyclock->timer. */
+static countdown_t *new_timer(void) {
+        countdown_t *t;
+
+        if (ttyclock->ntimers == MAX_TIMERS) {
+                printf("More than %d timers\n", MAX_TIMERS);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->timer = realloc(ttyclock->timer, (ttyclock->ntimers + 1)
+                                                   * sizeof(countdown_t));
+        ttyclock->heap = realloc(ttyclock->heap, (ttyclock->ntimers + 1)
+                                                 * sizeof(countdown_t *));
+        assert(ttyclock->timer != NULL && ttyclock->heap != NULL);
+
+        t = &ttyclock->timer[ttyclock->ntimers++];
+        memset(t, 0, sizeof(*t));
+        t->heap_index = -1;
+        t->streamed = -1;
+
+        return t;
+}
+
+/* Exits with an error message on a duration that can't be counted
+ * down. */
+static void check_time(countdown_t *t) {
+        /* A stopwatch never ends, so a program couldn't go on. */
+        if (t->up) {
+                if (ttyclock->program.parsing)
+                        bad_time("A segment can't count up");
+                return;
+        }
 
-        parse_time_arg(argv[optind]);
         /* Ensure input is anything but 0. */
-        if (time_is_zero()) {
-                puts("Time argument is zero");
+        if (t->duration == 0) bad_time("Time argument is zero");
+
+        /* Hours are shown with two digits. */
+        if (t->duration >= 100 * 3600)
+                bad_time("Time argument is 100 hours or more");
+}
+
+/* Adds a timer for a time argument. Exits on a bad one. */
+void add_timer(char *arg) {
+        countdown_t *t = new_timer();
+
+        parse_time_arg(t, arg);
+        check_time(t);
+}
+
+/* Adds a --hook: command, run as a timer gets to zero, or to hh:mm:ss
+ * left if it is given as hh:mm:ss=command. */
+static void add_hook(char *arg) {
+        size_t n = strspn(arg, "0123456789:");
+        countdown_t t;
+
+        if (ttyclock->hooks.n == MAX_HOOKS) {
+                printf("At most %d hooks\n", MAX_HOOKS);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->hooks.hook[ttyclock->hooks.n].at = 0;
+        if (n > 0 && arg[n] == '=') {
+                arg[n] = '\0';
+                parse_time_arg(&t, arg);
+                if (t.duration >= 100 * 3600)
+                        bad_time("Hook time is 100 hours or more");
+                ttyclock->hooks.hook[ttyclock->hooks.n].at =
+                        t.duration * NSEC_PER_SEC;
+                arg += n + 1;
+        }
+
+        if (*arg == '\0') {
+                puts("Empty hook command");
+                exit(EXIT_FAILURE);
+        }
+        ttyclock->hooks.hook[ttyclock->hooks.n++].cmd = arg;
+}
+
+/* Opens the --program file, or stdin for "-". Keys then come from the
+ * terminal, or nowhere if there is none. */
+static void program_open(void) {
+        int fd;
+
+        if (strcmp(ttyclock->program.path, "-") == 0) {
+                ttyclock->program.path = "stdin";
+                fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+                ttyclock->program.f = fdopen(fd, "r");
+
+                if ((fd = open("/dev/tty", O_RDONLY)) == -1)
+                        fd = open("/dev/null", O_RDONLY);
+                if (fd != -1) {
+                        dup2(fd, STDIN_FILENO);
+                        close(fd);
+                }
+        } else {
+                ttyclock->program.f = fopen(ttyclock->program.path, "r");
+        }
+
+        if (!ttyclock->program.f) {
+                perror(ttyclock->program.path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+/* Reads the next segment of the --program into t: a time argument per
+ * line, skipping blank lines and # comments. Returns False at the end
+ * of the program. Only the line at hand is ever held in memory. */
+Bool program_next(countdown_t *t) {
+        ssize_t n;
+        char *line;
+
+        if (!ttyclock->program.f) return False;
+
+        while ((n = getline(&ttyclock->program.buf, &ttyclock->program.cap,
+                            ttyclock->program.f)) != -1) {
+                ++ttyclock->program.line;
+                line = ttyclock->program.buf;
+                while (n > 0 && isspace((unsigned char)line[n - 1]))
+                        line[--n] = '\0';
+                while (isspace((unsigned char)*line)) ++line;
+                if (*line == '\0' || *line == '#') continue;
+
+                ttyclock->program.parsing = True;
+                parse_time_arg(t, line);
+                check_time(t);
+                ttyclock->program.parsing = False;
+                ++ttyclock->program.segments;
+                return True;
+        }
+
+        fclose(ttyclock->program.f);
+        ttyclock->program.f = NULL;
+
+        return False;
+}
+
+/* Starts every timer at the same instant, so they all tick together. */
+void start_timers(void) {
+        struct timespec now;
+        int i;
+
+        clock_now(&now);
+        for (i = 0; i < ttyclock->ntimers; ++i)
+                start_timer(&ttyclock->timer[i], &now);
+
+        arm_tick();
+}
+
+/* Returns CLOCK_REALTIME now, in nanoseconds. */
+static int64_t realtime_ns(void) {
+        struct timespec real;
+
+        clock_gettime(CLOCK_REALTIME, &real);
+        return real.tv_sec * NSEC_PER_SEC + real.tv_nsec;
+}
+
+/* Maps the --state file. With --resume the timers are read from it,
+ * otherwise it is made afresh for the timers given. */
+static void state_open(void) {
+        const char *path = ttyclock->state.path;
+        Bool resume = ttyclock->state.resume;
+        state_file_t *f;
+        struct stat st;
+        countdown_t *t;
+        size_t size;
+        uint32_t i;
+        int fd;
+
+        fd = open(path, resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+
+        if (resume) {
+                size = fstat(fd, &st) == 0 ? st.st_size : 0;
+        } else {
+                size = sizeof(state_file_t)
+                       + ttyclock->ntimers * sizeof(state_timer_t);
+                if (ftruncate(fd, size) == -1) {
+                        perror(path);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        f = size < sizeof(state_file_t) ? MAP_FAILED
+            : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (f == MAP_FAILED || (resume && (f->magic != STATE_MAGIC
+            || f->ntimers == 0 || f->ntimers > MAX_TIMERS
+            || size < sizeof(state_file_t)
+                      + f->ntimers * sizeof(state_timer_t)))) {
+                fprintf(stderr, "%s: not a ttytimer state file\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->state.file = f;
+        ttyclock->state.size = size;
+
+        if (resume) {
+                for (i = 0; i < f->ntimers; ++i) {
+                        t = new_timer();
+                        t->duration = f->timer[i].duration;
+                        memcpy(t->date.timestr, f->timer[i].timestr,
+                               sizeof(f->timer[i].timestr) - 1);
+                        /* Stopwatches are the timers without a duration. */
+                        t->up = t->duration == 0;
+                        t->labellen = strlen(t->date.timestr);
+                }
+                return;
+        }
+
+        f->magic = STATE_MAGIC;
+        f->ntimers = ttyclock->ntimers;
+        for (i = 0; i < f->ntimers; ++i) {
+                f->timer[i].duration = ttyclock->timer[i].duration;
+                memcpy(f->timer[i].timestr, ttyclock->timer[i].date.timestr,
+                       sizeof(f->timer[i].timestr));
+                atomic_store(&f->timer[i].left, -1);
+        }
+}
+
+/* Records t's deadline, or the time it has left while paused, in the
+ * --state file. Only memory is written; the kernel writes the page back
+ * whenever it likes, even once the process is killed. */
+void state_save(countdown_t *t) {
+        state_timer_t *s;
+        struct timespec now;
+
+        if (!ttyclock->state.file) return;
+
+        s = &ttyclock->state.file->timer[t - ttyclock->timer];
+
+        /* A stopwatch keeps the time it ran instead. */
+        if (t->paused) {
+                atomic_store(&s->left, t->up ? -t->left_ns : t->left_ns);
+                return;
+        }
+
+        clock_now(&now);
+        atomic_store_explicit(&s->deadline,
+                              realtime_ns() + ts_diff_ns(&t->deadline, &now),
+                              memory_order_relaxed);
+        /* Commits the deadline: it can't be reordered after this. */
+        atomic_store_explicit(&s->left, -1, memory_order_release);
+}
+
+/* Picks the timers of a --state file up where they were: running ones
+ * against their wall-clock deadline, paused ones with what they had
+ * left. Nothing is counted down again. */
+static void resume_timers(void) {
+        state_timer_t *s = ttyclock->state.file->timer;
+        struct timespec now;
+        int64_t real = realtime_ns(), left;
+        countdown_t *t;
+        int i;
+
+        clock_now(&now);
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                t = &ttyclock->timer[i];
+                t->dirty = True;
+
+                left = atomic_load_explicit(&s[i].left, memory_order_acquire);
+                if (left >= 0) {
+                        t->paused = True;
+                        t->left_ns = t->up ? -left : left;
+                        continue;
+                }
+
+                t->deadline = now;
+                ts_add_ns(&t->deadline, atomic_load(&s[i].deadline) - real);
+                schedule_tick(t, &now);
+                heap_update(t);
+        }
+
+        arm_tick();
+}
+
+/* Converts the name of a colour to its ncurses number. Case insensitive. */
+int color_name_to_number(const char *color) {
+
+        if (strcasecmp(color, "black") == 0) return COLOR_BLACK;
+        else if (strcasecmp(color, "red") == 0) return COLOR_RED;
+        else if (strcasecmp(color, "green") == 0) return COLOR_GREEN;
+        else if (strcasecmp(color, "yellow") == 0) return COLOR_YELLOW;
+        else if (strcasecmp(color, "blue") == 0) return COLOR_BLUE;
+        else if (strcasecmp(color, "magenta") == 0) return COLOR_MAGENTA;
+        else if (strcasecmp(color, "cyan") == 0) return COLOR_CYAN;
+        else if (strcasecmp(color, "white") == 0) return COLOR_WHITE;
+        else return -1;
+}
+
+/* Parses an alarm pattern, hz:ms[,hz:ms...][/repeats], into ttyclock.
+ * Returns False if it isn't one. */
+static Bool parse_alarm_pattern(const char *arg) {
+        alarm_step_t *step = ttyclock->alarm.step;
+        const char *p = arg;
+        char *end;
+        int n = 0;
+
+        do {
+                if (n == MAX_ALARM_STEPS) return False;
+
+                step[n].hz = strtol(p, &end, 10);
+                if (end == p || *end != ':' || step[n].hz < 0) return False;
+
+                p = end + 1;
+                step[n].ms = strtol(p, &end, 10);
+                if (end == p || step[n].ms <= 0) return False;
+
+                p = end;
+                ++n;
+        } while (*p++ == ',');
+
+        ttyclock->alarm.repeats = 0;
+        if (p[-1] == '/') {
+                ttyclock->alarm.repeats = strtol(p, &end, 10);
+                if (end == p || ttyclock->alarm.repeats <= 0) return False;
+                p = end + 1;
+        }
+
+        if (p[-1] != '\0') return False;
+
+        ttyclock->alarm.nsteps = n;
+        return True;
+}
+
+/* Sets up the clock on a screen that writes to fd instead of the user's
+ * terminal, for --soak and the benchmarks. */
+void init_headless(int fd) {
+        FILE *out = fdopen(dup(fd), "w");
+        FILE *in = fdopen(dup(fd), "r");
+        char *term = getenv("TERM");
+
+        if (!out || !in) {
+                perror("ttytimer");
+                exit(EXIT_FAILURE);
+        }
+
+        ttyclock->ttyfd = fd;
+        ttyclock->ttyscr = newterm(term && *term ? term : "xterm", out, in);
+        if (!ttyclock->ttyscr) {
+                fputs("Cannot set up a headless terminal\n", stderr);
                 exit(EXIT_FAILURE);
         }
 
         init();
-        attron(A_BLINK);
-        while (ttyclock->running) {
-                draw_clock();
-                key_event();
-                if (!time_is_zero()) update_hour();
+}
+
+/* Returns the CPU time used by the process so far, in seconds. */
+double cpu_seconds(void) {
+        struct rusage ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+               + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* Returns the time t shows, in units of its last digit. */
+static long long shown_units(const countdown_t *t) {
+        long long secs, frac = 0;
+        int i;
+
+        secs = (t->date.hour[0] * 10 + t->date.hour[1]) * 3600
+               + (t->date.minute[0] * 10 + t->date.minute[1]) * 60
+               + t->date.second[0] * 10 + t->date.second[1];
+        if (t->coarse) return secs / (COARSE_NS / NSEC_PER_SEC);
+
+        for (i = 0; i < ttyclock->option.frac; ++i)
+                frac = frac * 10 + t->date.frac[i];
+
+        return secs * (NSEC_PER_SEC / frac_unit()) + frac;
+}
+
+/* Returns whether every digit t shows is one its place can show. */
+static Bool digits_valid(const countdown_t *t) {
+        int i;
+
+        for (i = 0; i < 2; ++i) {
+                if (t->date.hour[i] > 9 || t->date.minute[i] > 9
+                    || t->date.second[i] > 9 || t->date.frac[i] > 9)
+                        return False;
+        }
+
+        return t->date.minute[0] < 6 && t->date.second[0] < 6;
+}
+
+/* Counts the timers down on a virtual clock that jumps straight from
+ * tick to tick, drawing every frame on /dev/null. Checks that every
+ * value shown is the time left, rounded up, that no value is skipped on
+ * a timer on screen, and that zero shows exactly at the deadline.
+ * Returns the exit code. */
+static int soak(void) {
+        long long unit, u, left, want, *last, *step;
+        unsigned long errors = 0;
+        countdown_t *t;
+        double cpu;
+        int i;
+
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                if (ttyclock->timer[i].up) {
+                        puts("--soak only counts down");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        ttyclock->clock = virtual_now;
+        init_events();
+        init_headless(open("/dev/null", O_RDWR));
+
+        last = malloc(ttyclock->ntimers * sizeof(*last));
+        step = malloc(ttyclock->ntimers * sizeof(*step));
+        assert(last != NULL && step != NULL);
+
+        unit = frac_unit();
+        cpu = cpu_seconds();
+        start_timers();
+
+        /* What each timer showed last, in ns, and its unit then */
+        for (i = 0; i < ttyclock->ntimers; ++i) {
+                last[i] = ttyclock->timer[i].duration * NSEC_PER_SEC;
+                step[i] = ttyclock->timer[i].coarse ? COARSE_NS : unit;
+        }
+
+        while (ttyclock->heapn > 0 && errors < 10) {
+                ttyclock->vnow = ttyclock->heap[0]->next_tick;
+                run_ticks();
+                draw_timers();
+
+                for (i = 0; i < ttyclock->ntimers; ++i) {
+                        t = &ttyclock->timer[i];
+                        if (t->heap_index == -1) continue;
+
+                        /* What a tile off screen would show */
+                        if (t->hidden) update_hour(t);
+
+                        u = t->coarse ? COARSE_NS : unit;
+                        left = ts_diff_ns(&t->deadline, &ttyclock->vnow);
+                        want = left <= 0 ? 0 : (left + u - 1) / u;
+
+                        if (!digits_valid(t) || shown_units(t) != want
+                            || (!t->hidden && last[i] - want * u > step[i])) {
+                                fprintf(stderr, "timer %d: shows %lld at "
+                                        "%lld ns before the deadline, "
+                                        "%lld ns before, expected %lld\n",
+                                        i, shown_units(t), left, last[i], want);
+                                ++errors;
+                        }
+                        last[i] = want * u;
+                        step[i] = u;
+
+                        if (want > 0) continue;
+
+                        if (left != 0) {
+                                fprintf(stderr, "timer %d: zero at %lld ns "
+                                        "from the deadline\n", i, -left);
+                                ++errors;
+                        }
+                        heap_remove(t);
+                }
         }
 
+        cpu = cpu_seconds() - cpu;
         endwin();
+        free(last);
+        free(step);
+
+        printf("timers: %d, virtual time: %.1f h, ticks: %lu, frames: %lu\n"
+               "cpu: %.2f s, %.0f ticks/s, errors: %lu\n",
+               ttyclock->ntimers,
+               (ttyclock->vnow.tv_sec + ttyclock->vnow.tv_nsec / 1e9) / 3600,
+               ttyclock->drift.ticks, ttyclock->drawn.frames,
+               cpu, ttyclock->drift.ticks / cpu, errors);
+
+        return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Prints how late ticks were against the ideal schedule, and how many
+ * cells each frame wrote. */
+static void drift_report(void) {
+        unsigned long n = ttyclock->drift.ticks;
+
+        fprintf(stderr, "ticks: %lu, lateness max: %.3f ms, mean: %.3f ms\n",
+                n, ttyclock->drift.max_ns / 1e6,
+                n ? ttyclock->drift.total_ns / 1e6 / n : 0.0);
+
+        n = ttyclock->drawn.frames;
+        fprintf(stderr, "frames: %lu, cells written max: %lu, mean: %.1f\n",
+                n, ttyclock->drawn.max_cells,
+                n ? (double)ttyclock->drawn.cells / n : 0.0);
+        if (ttyclock->option.backend == BACKEND_ANSI)
+                fprintf(stderr, "bytes written: %lu, mean: %.1f per frame\n",
+                        ttyclock->ansi.bytes,
+                        n ? (double)ttyclock->ansi.bytes / n : 0.0);
+}
+
+/* Allocates ttyclock, set to the defaults the options start from. */
+void alloc_ttyclock(void) {
+        ttyclock = malloc(sizeof(ttyclock_t));
+        assert(ttyclock != NULL);
+        memset(ttyclock, 0, sizeof(ttyclock_t));
+        clock_gettime(CLOCK_MONOTONIC, &ttyclock->stats.mark);
+        pthread_mutex_init(&ttyclock->stats.lock, NULL);
+
+        /* Default color */
+        ttyclock->option.color = COLOR_GREEN; /* COLOR_GREEN = 2 */
+        ttyclock->option.font = &fonts[0];
+
+        /* Default alarm: a second of tone every other second */
+        #ifdef TOOT
+        ttyclock->alarm.kind = ALARM_TOOT;
+        #else
+        ttyclock->alarm.kind = ALARM_BELL;
+        #endif
+        parse_alarm_pattern("500:1000,0:1000");
+        ttyclock->ttyfd = STDOUT_FILENO;
+        ttyclock->ctl.fd = -1;
+        ttyclock->clock = monotonic_now;
+        ttyclock->program.timer = -1;
+        ttyclock->hooks.max = HOOK_PROCS;
+        ttyclock->scale = 1;
+
+        atexit(cleanup);
+}
+
+/* ttytimer-bench links this file in with a main() of its own (see
+ * bench.c). */
+#ifdef TTYTIMER_BENCH
+#define main ttytimer_main
+#endif
+
+int main(int argc, char **argv) {
+        int c;
+        enum { OPT_BACKEND = 256, OPT_STATS, OPT_ALARM,
+               OPT_STATE, OPT_RESUME, OPT_SOCKET, OPT_CTL, OPT_SOAK,
+               OPT_POWERSAVE, OPT_MIRROR, OPT_STREAM, OPT_BINARY,
+               OPT_PROGRAM, OPT_HOOK, OPT_HOOK_MAX, OPT_LAPS, OPT_RECORD,
+               OPT_REPLAY, OPT_SPEED, OPT_FONT };
+        const char *ctl = NULL, *mirror[MAX_MIRRORS], *recording = NULL;
+        int nmirrors = 0, fd, i;
+        double speed = 1;
+        char *end;
+        Bool soak_test = False;
+        const struct option long_options[] = {
+                { "backend", required_argument, NULL, OPT_BACKEND },
+                { "stats", optional_argument, NULL, OPT_STATS },
+                { "alarm", required_argument, NULL, OPT_ALARM },
+                { "state", required_argument, NULL, OPT_STATE },
+                { "resume", no_argument, NULL, OPT_RESUME },
+                { "socket", required_argument, NULL, OPT_SOCKET },
+                { "ctl", required_argument, NULL, OPT_CTL },
+                { "soak", no_argument, NULL, OPT_SOAK },
+                { "powersave", no_argument, NULL, OPT_POWERSAVE },
+                { "mirror", required_argument, NULL, OPT_MIRROR },
+                { "stream", optional_argument, NULL, OPT_STREAM },
+                { "binary", no_argument, NULL, OPT_BINARY },
+                { "program", required_argument, NULL, OPT_PROGRAM },
+                { "hook", required_argument, NULL, OPT_HOOK },
+                { "hook-max", required_argument, NULL, OPT_HOOK_MAX },
+                { "laps", required_argument, NULL, OPT_LAPS },
+                { "record", required_argument, NULL, OPT_RECORD },
+                { "replay", required_argument, NULL, OPT_REPLAY },
+                { "speed", required_argument, NULL, OPT_SPEED },
+                { "font", required_argument, NULL, OPT_FONT },
+                { NULL, 0, NULL, 0 }
+        };
+
+        alloc_ttyclock();
+
+        int color;
+        while ((c = getopt_long(argc, argv, "vbhxzDC:f:a:",
+                                long_options, NULL)) != -1) {
+                switch(c) {
+                case 'h':
+                        usage(argv[0], EXIT_SUCCESS);
+                        break;
+                case 'v':
+                        puts("ttytimer v0.1");
+                        exit(EXIT_SUCCESS);
+                        break;
+                case 'b':
+                        ttyclock->option.bold = True;
+                        break;
+                case 'C':
+                        if ((color = color_name_to_number(optarg)) != -1) {
+                                ttyclock->option.color = color;
+                        } else {
+                                printf("Invalid color specified: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case 'x':
+                        ttyclock->option.box = True;
+                        break;
+                case 'D':
+                        ttyclock->option.drift = True;
+                        break;
+                case 'z':
+                        ttyclock->option.fill = True;
+                        break;
+                case 'f':
+                        ttyclock->option.frac = atoi(optarg);
+                        if (ttyclock->option.frac < 1
+                            || ttyclock->option.frac > MAX_FRAC_DIGITS) {
+                                printf("Invalid fraction digits: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case 'a':
+                        if (!parse_alarm_pattern(optarg)) {
+                                printf("Invalid alarm pattern: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case OPT_ALARM:
+                        if (!strcmp(optarg, "toot")) {
+                                ttyclock->alarm.kind = ALARM_TOOT;
+                        } else if (!strcmp(optarg, "bell")) {
+                                ttyclock->alarm.kind = ALARM_BELL;
+                        } else if (!strcmp(optarg, "flash")) {
+                                ttyclock->alarm.kind = ALARM_FLASH;
+                        } else if (!strcmp(optarg, "off")) {
+                                ttyclock->alarm.kind = ALARM_OFF;
+                        } else {
+                                printf("Invalid alarm specified: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case OPT_STATE:
+                        ttyclock->state.path = optarg;
+                        break;
+                case OPT_RESUME:
+                        ttyclock->state.resume = True;
+                        break;
+                case OPT_SOCKET:
+                        ttyclock->ctl.path = optarg;
+                        break;
+                case OPT_CTL:
+                        ctl = optarg;
+                        break;
+                case OPT_SOAK:
+                        soak_test = True;
+                        break;
+                case OPT_POWERSAVE:
+                        ttyclock->option.powersave = True;
+                        break;
+                case OPT_MIRROR:
+                        if (nmirrors == MAX_MIRRORS) {
+                                printf("At most %d mirrors\n", MAX_MIRRORS);
+                                exit(EXIT_FAILURE);
+                        }
+                        mirror[nmirrors++] = optarg;
+                        break;
+                case OPT_STREAM:
+                        ttyclock->option.backend = BACKEND_STREAM;
+                        ttyclock->stream.path = optarg;
+                        break;
+                case OPT_BINARY:
+                        ttyclock->stream.binary = True;
+                        break;
+                case OPT_PROGRAM:
+                        ttyclock->program.path = optarg;
+                        break;
+                case OPT_HOOK:
+                        add_hook(optarg);
+                        break;
+                case OPT_LAPS:
+                        ttyclock->lap.path = optarg;
+                        break;
+                case OPT_RECORD:
+                        ttyclock->record.path = optarg;
+                        break;
+                case OPT_REPLAY:
+                        recording = optarg;
+                        break;
+                case OPT_SPEED:
+                        speed = strtod(optarg, &end);
+                        if (*end || end == optarg || speed < 0) {
+                                printf("Invalid speed: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case OPT_HOOK_MAX:
+                        ttyclock->hooks.max = atoi(optarg);
+                        if (ttyclock->hooks.max < 1
+                            || ttyclock->hooks.max > MAX_HOOK_PROCS) {
+                                printf("Invalid hook limit: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case OPT_STATS:
+                        ttyclock->option.stats = True;
+                        ttyclock->stats.path = optarg;
+                        break;
+                case OPT_BACKEND:
+                        if (!strcmp(optarg, "curses")) {
+                                ttyclock->option.backend = BACKEND_CURSES;
+                        } else if (!strcmp(optarg, "ansi")) {
+                                ttyclock->option.backend = BACKEND_ANSI;
+                        } else {
+                                printf("Invalid backend specified: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        break;
+                case OPT_FONT:
+                        for (i = 0; i < N_FONTS; ++i)
+                                if (!strcmp(optarg, fonts[i].name)) break;
+                        if (i == N_FONTS) {
+                                printf("Invalid font specified: %s\n", optarg);
+                                exit(EXIT_FAILURE);
+                        }
+                        ttyclock->option.font = &fonts[i];
+                        break;
+                default:
+                        usage(argv[0], EXIT_FAILURE);
+                        break;
+                }
+        }
+
+        if (nmirrors && ttyclock->option.backend == BACKEND_STREAM) {
+                puts("--stream has no screen to mirror");
+                exit(EXIT_FAILURE);
+        }
+
+        /* The recording is cells the ANSI backend worked out. */
+        if (ttyclock->record.path) {
+                if (ttyclock->option.backend == BACKEND_STREAM) {
+                        puts("--stream has no frames to record");
+                        exit(EXIT_FAILURE);
+                }
+                ttyclock->option.backend = BACKEND_ANSI;
+        }
+
+        /* Drive another ttytimer, or play a recording, instead */
+        if (ctl) exit(ctl_client(ctl, argc - optind, argv + optind));
+        if (recording) exit(replay(recording, speed));
+
+        if (ttyclock->state.resume) {
+                /* The timers come from the state file. */
+                if (!ttyclock->state.path || optind != argc
+                    || ttyclock->program.path)
+                        usage(argv[0], EXIT_FAILURE);
+        } else {
+                /* The program's timer comes first. */
+                if (ttyclock->program.path) {
+                        program_open();
+                        ttyclock->program.timer = 0;
+                        if (!program_next(new_timer())) {
+                                printf("%s: no segments\n",
+                                       ttyclock->program.path);
+                                exit(EXIT_FAILURE);
+                        }
+                }
+
+                /* We're missing the final time argument. */
+                if (optind == argc && !ttyclock->program.path)
+                        usage(argv[0], EXIT_FAILURE);
+
+                for (; optind < argc; ++optind) add_timer(argv[optind]);
+        }
+
+        if (soak_test) exit(soak());
+        startup_mark(START_ARGS);
+
+        if (ttyclock->state.path) state_open();
+        if (ttyclock->ctl.path) ctl_open();
+        if (ttyclock->lap.path) lap_open();
+
+        init_events();
+        startup_mark(START_SETUP);
+
+        if (ttyclock->option.backend == BACKEND_ANSI) {
+                ansi_init();
+                if (ttyclock->record.path) record_open();
+        } else if (ttyclock->option.backend == BACKEND_STREAM) {
+                stream_open();
+        } else {
+                init();
+                attron(A_BLINK);
+        }
+        for (c = 0; c < nmirrors; ++c) {
+                if ((fd = open(mirror[c], O_RDWR | O_NOCTTY | O_CLOEXEC)) == -1) {
+                        end_screen();
+                        perror(mirror[c]);
+                        exit(EXIT_FAILURE);
+                }
+                mirror_open(fd);
+        }
+        if (ttyclock->option.stats) {
+                ttyclock->stats.iofd = open("/proc/thread-self/io",
+                                            O_RDONLY | O_CLOEXEC);
+                ttyclock->stats.bytes = tty_bytes();
+                clock_gettime(CLOCK_MONOTONIC, &ttyclock->stats.start);
+        }
+        startup_mark(START_SCREEN);
+
+        if (ttyclock->state.resume) resume_timers();
+        else start_timers();
+        startup_mark(START_TIMERS);
+
+        /* The first frame goes out before the threads and the hooks,
+         * which it doesn't need, are set up. */
+        draw_timers();
+        if (ttyclock->option.backend != BACKEND_STREAM) render_start();
+        if (ttyclock->hooks.n) hook_init();
+        alarm_start();
+
+        /* Only for this thread: the alarm's tones keep their timing. */
+        if (ttyclock->option.powersave)
+                prctl(PR_SET_TIMERSLACK, POWERSAVE_SLACK_NS);
+
+        while (ttyclock->running) {
+                draw_timers();
+                wait_event();
+        }
+
+        render_stop();
+        record_stop();
+        alarm_stop();
+        lap_stop();
+        end_screen();
+
+        if (ttyclock->option.stats) {
+                stats_take(&ttyclock->stats.taken);
+                stats_report(&ttyclock->stats.taken);
+        }
+        if (ttyclock->option.drift) drift_report();
 
         return 0;
 }
@@ -44,16 +44,271 @@
 #include <ncurses.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <spawn.h>
+#include <limits.h>
 
 /* Macro */
-#define NORMFRAMEW 35
-#define SECFRAMEW  54
 #define DATEWINH   3
 /* Maximum number of digits in a time string, hh:mm:ss. */
 #define N_TIME_DIGITS 6
+/* Digits of fractions of a second after them, at most (see -f) */
+#define MAX_FRAC_DIGITS 2
+#define N_DIGITS (N_TIME_DIGITS + MAX_FRAC_DIGITS)
+#define NSEC_PER_SEC  1000000000LL
+/* Rows of the tallest digit font (see mkfont.c) */
+#define MAX_GLYPHH 7
+/* With --powersave, timers further than this from their deadline show
+ * only hours and minutes and tick once a minute, and the main thread
+ * lets the kernel batch its wakeups by this much (see schedule_tick()) */
+#define COARSE_NS (60 * NSEC_PER_SEC)
+#define POWERSAVE_SLACK_NS 500000000LL
+/* Bytes of --stream records held for a slow reader, and room kept for
+ * one JSON record */
+#define STREAM_BUFSIZE 65536
+#define STREAM_RECMAX  512
+/* Most timers run at once, and kept in a --state file */
+#define MAX_TIMERS 1024
+/* Most terminals the timers can be mirrored to (see --mirror) */
+#define MAX_MIRRORS 8
+/* Most --hook commands, most of them running at once, and how many
+ * may run at once by default (see hook_spawn()) */
+#define MAX_HOOKS      16
+#define MAX_HOOK_PROCS 64
+#define HOOK_PROCS     4
+/* Laps of a stopwatch held for the --laps writer, a power of two, and
+ * how many it is woken for (see lap_take()) */
+#define LAP_RING     4096
+#define LAP_BATCH    64
+#define LAP_FLUSH_MS 1000
+/* Bytes of --record events held for its writer, a power of two, and how
+ * often it writes out what there is (see record_out()) */
+#define RECORD_RING     (1 << 20)
+#define RECORD_FLUSH_MS 1000
+/* Longest label of a timer (see parse_time_arg()) */
+#define LABELMAX 32
+/* Space between the tiles of several timers (see set_center()) */
+#define TILEGAPW 2
+#define TILEGAPH 1
+/* Histogram buckets per power of two, and in all (see hist_add()) */
+#define HIST_SUB     8
+#define HIST_BUCKETS (64 * HIST_SUB)
+/* Steps in an alarm pattern (see -a) */
+#define MAX_ALARM_STEPS 16
+/* First bytes of a --state file, "ttytmr" and a version */
+#define STATE_MAGIC 0x01726d7479747474ULL
+/* Control socket clients at once, and the longest command (see --ctl) */
+#define MAX_CTL_CLIENTS 32
+#define CTL_LINEMAX     128
 
 typedef enum { False, True } Bool;
 
+/* How frames get to the terminal */
+typedef enum { BACKEND_CURSES, BACKEND_ANSI, BACKEND_STREAM } Backend;
+
+/* A run of lit columns in a row of a digit glyph */
+typedef struct { unsigned char col, len; } span_t;
+
+/* A digit font, as make generates it from mkfont.c into fonts.h. The
+ * spans of row r of digit n are span[row[n][r]] up to span[row[n][r + 1]]. */
+typedef struct
+{
+        const char *name;
+        int w, h;  /* columns and rows of a digit */
+        unsigned short bits[10][MAX_GLYPHH];  /* lit columns, leftmost highest */
+        const span_t *span;
+        unsigned short row[10][MAX_GLYPHH + 1];
+} font_t;
+
+/* What startup goes through before the first frame (see startup_mark()) */
+typedef enum { START_ARGS, START_SETUP, START_SCREEN, START_TIMERS,
+               START_FRAME, START_PHASES } StartPhase;
+
+/* Where a countdown is, as --stream reports it */
+typedef enum { PHASE_RUNNING, PHASE_PAUSED, PHASE_DONE } Phase;
+
+/* A --stream --binary record, in host byte order */
+typedef struct
+{
+        uint64_t seq;      /* records queued before this one */
+        int64_t left_ns;   /* time left, 0 once done, or minus the time
+                            * a stopwatch has run */
+        uint64_t dropped;  /* records dropped so far (see stream_timers()) */
+        uint16_t timer;
+        uint8_t phase;     /* Phase */
+        uint8_t event;     /* 1 on the first record of a done timer */
+        uint32_t reserved;
+} stream_record_t;
+
+/* A lap of a stopwatch, as the --laps writer gets it */
+typedef struct
+{
+        int64_t stamp_ns;    /* CLOCK_REALTIME of the key */
+        int64_t elapsed_ns;  /* on the stopwatch */
+        int64_t split_ns;    /* since the lap before */
+        uint32_t timer;
+        uint32_t n;          /* of the timer's laps, from 1 */
+} lap_t;
+
+/* How the alarm sounds (see alarm_play()) */
+typedef enum { ALARM_TOOT, ALARM_BELL, ALARM_FLASH, ALARM_OFF } Alarm;
+
+/* One step of an alarm pattern: a tone of hz, or silence if 0, for ms */
+typedef struct
+{
+        int hz;
+        int ms;
+} alarm_step_t;
+
+/* Counts of values in log-linear buckets, each at most 1/HIST_SUB wide
+ * relative to its value */
+typedef struct
+{
+        unsigned long count[HIST_BUCKETS];
+        unsigned long n;
+        long long max;
+} hist_t;
+
+/* The main thread's --stats figures, as stats_take() copies them */
+typedef struct
+{
+        struct timespec at;
+        unsigned long wakeups;
+        unsigned long mode_wakeups[2];
+        long long mode_ns[2];
+        unsigned long published;
+        unsigned long hooks_started, hooks_skipped, hooks_failed;
+        int hooks_running;
+        uint64_t laps;
+        unsigned long laps_dropped;
+        hist_t keys, late, spawn;
+} stats_main_t;
+
+/* What a countdown shows ([2] = number by number) */
+typedef struct
+{
+        unsigned int hour[2];
+        unsigned int minute[2];
+        unsigned int second[2];
+        unsigned int frac[MAX_FRAC_DIGITS];  /* tenths, hundredths */
+        /* [label ]hh:mm:ss, or a stopwatch's label and last lap */
+        char timestr[LABELMAX + 40];
+} date_t;
+
+/* A countdown as the main thread publishes it to be drawn (see
+ * publish_timers()) */
+typedef struct
+{
+        date_t date;
+        Bool coarse;
+        Bool lit;     /* the colons' blink phase */
+} shown_t;
+
+/* What the main thread asks of the screen besides the timers (see
+ * render_frame()) */
+typedef struct
+{
+        int color;
+        int selected;
+        unsigned long resizes;  /* SIGWINCHes */
+        unsigned long dumps;    /* --stats reports, repainting after */
+        struct timespec at;     /* when published, for --record */
+} view_t;
+
+/* One countdown and the tile it is drawn in */
+typedef struct
+{
+        /* Date content */
+        unsigned int duration;  /* in seconds */
+        date_t date;
+
+        /* Countdown schedule, absolute CLOCK_MONOTONIC times. A stopwatch
+         * counts up from its deadline. */
+        Bool up;
+        struct timespec deadline;
+        struct timespec next_tick;
+        Bool paused;
+        Bool coarse;        /* --powersave: minutes only, see COARSE_NS */
+        long long left_ns;  /* time left when paused */
+        int heap_index;     /* in ttyclock->heap, -1 while paused */
+
+        /* Clock geometry */
+        struct
+        {
+                int x, y, w, h;
+                /* For rebound use (see clock_rebound())*/
+                int a, b;
+        } geo;
+
+        /* Clock member, all of it the render thread's but hidden, which
+         * the ticks look at */
+        WINDOW *framewin;
+        WINDOW *datewin;
+        atomic_bool hidden;  /* tile does not fit on the screen */
+        Bool dirty;   /* has to be updated and published */
+        shown_t shown;  /* what the last frame was drawn from */
+        Bool redraw;    /* has to be drawn */
+        int streamed; /* Phase of the last --stream record, -1 before
+                       * it or after its done event was dropped */
+        /* --hook bits: hooks whose time left t is above, and those it
+         * has come down to, to be run (see hook_check()) */
+        unsigned int hooks_armed;
+        unsigned int hooks_due;
+
+        /* Stopwatch laps taken and shown, the time at the last one and
+         * its split, and the length of timestr without it (see
+         * lap_take()) */
+        unsigned long laps, lap_shown;
+        long long lap_ns, lap_split;
+        int labellen;
+
+        /* What is on screen since the last full redraw (see draw_clock()).
+         * A digit of -1 has to be drawn in full. */
+        struct
+        {
+                int digit[N_DIGITS];
+                unsigned int numcolor[N_DIGITS];
+                chtype dotcolor;
+                Bool point;
+                Bool date;
+        } drawn;
+} countdown_t;
+
+/* A timer in a --state file. left is what says which state it is in:
+ * pausing stores only left, and running stores the deadline first and
+ * then left = -1, released after it. A process killed at any point
+ * leaves either the old state or the new one (see state_save()). */
+typedef struct
+{
+        _Atomic int64_t deadline;  /* CLOCK_REALTIME ns, while running */
+        _Atomic int64_t left;      /* ns left while paused, -1 running */
+        uint32_t duration;         /* in seconds, for restarts */
+        char timestr[LABELMAX + 10];
+} state_timer_t;
+
+/* The --state file, mapped shared and updated in place */
+typedef struct
+{
+        uint64_t magic;
+        uint32_t ntimers;
+        uint32_t reserved;
+        state_timer_t timer[];
+} state_file_t;
+
 /* Global ttyclock struct */
 typedef struct
 {
@@ -62,7 +317,9 @@ typedef struct
 
         /* terminal variables */ 
         SCREEN *ttyscr;
+        int ttyfd;
         int bg;
+        Bool resize;
 
         /* Running option */
         struct
@@ -70,64 +327,334 @@ typedef struct
                 Bool box;
                 int color;
                 Bool bold;
+                Bool drift;
+                Bool stats;
+                int frac;  /* digits of fractions of a second shown */
+                Bool fill;  /* scale the digits to fill the terminal */
+                Bool powersave;
+                Backend backend;
+                const font_t *font;
         } option;
 
-        /* Clock geometry */
+        /* Timers, and the one the keys act on */
+        countdown_t *timer;
+        int ntimers;
+        int selected;
+
+        /* Running timers as a min-heap on next_tick (see handle_tick()) */
+        countdown_t **heap;
+        int heapn;
+
+        /* time.h utils */
+        struct tm *tm;
+        time_t lt;
+
+        /* Where every time read comes from (see clock_now()), and the
+         * time of the virtual clock of --soak */
+        void (*clock)(struct timespec *now);
+        struct timespec vnow;
+
+        /* Event sources for the main loop (see wait_event()) */
+        int timerfd;
+        int sigfd;
+
+        /* Tick lateness against next_tick (see handle_tick()) */
         struct
         {
-                int x, y, w, h;
-                /* For rebound use (see clock_rebound())*/
-                int a, b;
-        } geo;
+                unsigned long ticks;
+                long long max_ns;
+                long long total_ns;
+        } drift;
+
+        /* Digit glyphs by digit, number color and row, each row the font's
+         * width * scale cells ready to copy with mvwaddchnstr() (see
+         * build_glyphs() and glyph_row()). Rebuilt only when the scale
+         * or font changes. */
+        chtype *glyph;
+        int scale;
+        int glyphscale;
+        const font_t *glyphfont;
 
-        /* Date content ([2] = number by number) */
-        int initial_digits[N_TIME_DIGITS];
+        /* Cells written per frame */
         struct
         {
-                unsigned int hour[2];
-                unsigned int minute[2];
-                unsigned int second[2];
-                char timestr[9];  /* hh:mm:ss */
-        } date;
+                unsigned long frames;
+                unsigned long cells;
+                unsigned long max_cells;
+        } drawn;
 
-        /* time.h utils */
-        struct tm *tm;
-        time_t lt;
+        /* Raw ANSI backend: what is on the terminal (front) and what the
+         * next frame should show (back), as chtypes (see ansi_flush()) */
+        struct
+        {
+                chtype *front, *back;
+                Bool *dirty;  /* rows of back that changed */
+                int rows, cols;
 
-        /* Clock member */
-        WINDOW *framewin;
-        WINDOW *datewin;
+                char *out;    /* escape sequences of one frame */
+                size_t outlen, outsize;
+                unsigned long bytes;
+
+                struct termios saved;
+        } ansi;
+
+        /* Alarm played by a worker thread while a running timer is at
+         * zero. The main loop only flips ring (see alarm_worker()). */
+        struct
+        {
+                Alarm kind;
+                alarm_step_t step[MAX_ALARM_STEPS];
+                int nsteps;
+                int repeats;     /* of the pattern, 0 until stopped */
+
+                atomic_bool ring;
+                atomic_bool quit;
+                int evfd;        /* wakes the worker when ring changes */
+                pthread_t thread;
+                Bool started;
+        } alarm;
+
+        /* Timers kept in a file across restarts (see state_open()) */
+        struct
+        {
+                const char *path;
+                Bool resume;
+                state_file_t *file;
+                size_t size;
+        } state;
+
+        /* Control socket, served from the main loop (see ctl_serve()) */
+        struct
+        {
+                const char *path;
+                int fd;  /* listening, -1 if none */
+                struct
+                {
+                        int fd;
+                        char buf[CTL_LINEMAX];
+                        size_t len;
+                        char *reply;  /* replies it hasn't taken yet */
+                        size_t replylen, sent;
+                } client[MAX_CTL_CLIENTS];
+                int nclients;
+                unsigned long requests;
+        } ctl;
+
+        /* Other terminals showing the same frames (see mirror_open()) */
+        struct
+        {
+                struct
+                {
+                        int fd;
+                        SCREEN *scr;  /* curses backend only */
+                        WINDOW *win;  /* all of scr */
+                } term[MAX_MIRRORS];
+                int n;
+                Bool sync;  /* copy the whole screen with the next frame */
+        } mirror;
+
+        /* The --program timer's segments, read a line at a time as each
+         * one starts (see program_next()) */
+        struct
+        {
+                const char *path;
+                FILE *f;           /* NULL once it has all been read */
+                char *buf;         /* the line, reused */
+                size_t cap;
+                unsigned long line, segments;
+                Bool parsing;      /* a line of it (see bad_time()) */
+                int timer;         /* -1 without a program */
+        } program;
+        Bool relayout;  /* set_center() before the next frame */
+
+        /* Commands run as timers come down to a time left, started with
+         * posix_spawn() and reaped on SIGCHLD (see hook_run()) */
+        struct
+        {
+                struct
+                {
+                        long long at;     /* ns left, 0 for the deadline */
+                        const char *cmd;  /* run with /bin/sh -c */
+                } hook[MAX_HOOKS];
+                int n;
+                int max;                  /* running at once */
+                pid_t pid[MAX_HOOK_PROCS];
+                int running;
+                Bool due;                 /* some timer has hooks_due */
+                Bool reap;                /* SIGCHLD came */
+                posix_spawnattr_t attr;
+                posix_spawn_file_actions_t actions;
+                unsigned long started, skipped, failed;
+        } hooks;
+
+        /* Laps of the stopwatches, passed from the main thread to a writer
+         * thread through a ring of LAP_RING, allocated up front. Only the
+         * main thread moves head and only the writer moves tail, each on
+         * a cache line of its own. */
+        struct
+        {
+                const char *path;  /* --laps, NULL for no ring */
+                int fd;
+                lap_t *ring;
+                _Alignas(64) _Atomic uint64_t head;
+                uint64_t tail_seen;     /* by the main thread, last time */
+                unsigned long dropped;  /* with the ring full */
+                _Alignas(64) _Atomic uint64_t tail;
+                int evfd;          /* wakes the writer for a batch */
+                pthread_t thread;
+                atomic_bool quit;
+        } lap;
+
+        /* Frames drawn on a thread of their own, so a stalled terminal
+         * holds up neither ticks nor keys. The main thread publishes the
+         * timers under a seqlock, and the render thread draws the latest
+         * of it (see publish_timers() and render_frame()). */
+        struct
+        {
+                Bool started;
+                _Atomic unsigned long seq;  /* odd while being written */
+                view_t want;       /* the main thread's, published as pub */
+                view_t pub;
+                shown_t *timer;    /* published, one per timer */
+                int n;
+                view_t cur;        /* the render thread's, last drawn */
+                shown_t *read;     /* the snapshot drawn from */
+                unsigned long published;
+                int evfd;          /* wakes the render thread */
+                pthread_t thread;
+                atomic_bool quit;
+        } render;
+
+        /* Frames written to a file as asciicast v2 events: the bytes
+         * ansi_flush() sends, escaped into a ring of RECORD_RING by the
+         * render thread and written out by a thread of their own. As for
+         * the laps, head and tail are each on a cache line of their own. */
+        struct
+        {
+                const char *path;  /* --record, NULL for no ring */
+                int fd;
+                char *ring;
+                _Alignas(64) _Atomic uint64_t head;
+                uint64_t pending;       /* end of the frame being put */
+                uint64_t tail_seen;     /* by the render thread */
+                uint64_t woken;         /* head the writer was woken at */
+                Bool open;              /* an event is being put */
+                Bool drop;              /* frames don't fit for now */
+                struct timespec start;  /* at 0.0 */
+                struct timespec at;     /* the frame's, from its snapshot */
+                unsigned long frames, dropped;
+                _Alignas(64) _Atomic uint64_t tail;
+                int evfd;          /* wakes the writer */
+                pthread_t thread;
+                atomic_bool quit;
+                atomic_bool ended;  /* the pipe's reader went away */
+        } record;
+
+        /* Records for --stream instead of frames (see stream_timers()) */
+        struct
+        {
+                const char *path;  /* NULL for stdout */
+                Bool binary;
+                int fd;
+                int flags;         /* to put back on exit */
+                char *buf;         /* STREAM_BUFSIZE */
+                size_t len, sent;
+                uint64_t seq, dropped;
+        } stream;
+
+        /* Per-frame costs for --stats (see stats_report()) */
+        struct
+        {
+                const char *path;  /* NULL for stderr */
+                Bool dump;         /* report asked for by SIGUSR1 */
+                /* The main thread's figures for a report the render
+                 * thread writes (see stats_dump()), under lock */
+                pthread_mutex_t lock;
+                stats_main_t taken;
+                struct timespec start;
+                unsigned long wakeups;
+                /* Wakeups and time waiting for a per-minute [1] or a
+                 * finer [0] tick (see wait_event()) */
+                unsigned long mode_wakeups[2];
+                long long mode_ns[2];
+                unsigned long refreshes;
+                unsigned long bytes;    /* tty_bytes() after the last frame */
+                unsigned long written;  /* bytes of all the frames */
+                int iofd;          /* /proc/thread-self/io of the drawing thread */
+                hist_t draw, keys, late, tty, refresh, spawn;
+                /* Time each startup phase took, the first frame's up to
+                 * its last byte written (see startup_mark()) */
+                long long startup[START_PHASES];
+                struct timespec mark;  /* end of the last phase */
+                StartPhase phase;      /* the next one */
+        } stats;
 
 } ttyclock_t;
 
 /* Prototypes */
 void init(void);
+void init_events(void);
 void signal_handler(int signal);
-void update_hour(void);
-void draw_number(int n, int x, int y, unsigned int color);
-void draw_clock(void);
-void clock_move(int x, int y, int w, int h);
-void set_second(void);
+void resize_clock(void);
+void end_screen(void);
+void start_timer(countdown_t *t, const struct timespec *now);
+void pause_timer(countdown_t *t);
+void state_save(countdown_t *t);
+Bool program_next(countdown_t *t);
+void update_hour(countdown_t *t);
+void draw_number(countdown_t *t, int pos, int n, int x, int y,
+                 unsigned int color);
+void draw_clock(countdown_t *t);
+void draw_timers(void);
+void render_frame(void);
+void invalidate_clock(countdown_t *t);
+void build_glyphs(void);
+void clock_move(countdown_t *t, int x, int y, int w, int h);
+void set_second(countdown_t *t);
 void set_center(void);
 void set_box(Bool b);
+void ansi_init(void);
+void ansi_resize(void);
+void ansi_flush(void);
+void ansi_end(void);
+void mirror_open(int fd);
+void mirror_update(void);
+void stream_open(void);
+void stream_timers(void);
+void stream_flush(void);
+void stream_end(void);
 void key_event(void);
+void arm_tick(void);
+void handle_tick(void);
+void wait_event(void);
+void add_timer(char *arg);
+void start_timers(void);
+void alloc_ttyclock(void);
+void handle_signals(void);
+void init_headless(int fd);
+void clock_now(struct timespec *now);
+void ts_add_ns(struct timespec *ts, long long ns);
+long long ts_diff_ns(const struct timespec *a, const struct timespec *b);
+double cpu_seconds(void);
+void hist_add(hist_t *h, long long v);
+long long hist_pct(const hist_t *h, double p);
+int digit_col(int pos);
+void render_start(void);
+void render_stop(void);
+void ctl_open(void);
+int ctl_connect(const char *path);
+void hook_init(void);
+void hook_spawn(countdown_t *t, int i);
+void lap_open(void);
+void lap_take(countdown_t *t);
+void lap_stop(void);
+void record_open(void);
+void record_stop(void);
 
-/* Global variable */
-ttyclock_t *ttyclock;
+/* Global variable, defined in ttytimer.c */
+extern ttyclock_t *ttyclock;
 
-/* Number matrix */
-const Bool number[][15] =
-{
-        {1,1,1,1,0,1,1,0,1,1,0,1,1,1,1}, /* 0 */
-        {0,0,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 1 */
-        {1,1,1,0,0,1,1,1,1,1,0,0,1,1,1}, /* 2 */
-        {1,1,1,0,0,1,1,1,1,0,0,1,1,1,1}, /* 3 */
-        {1,0,1,1,0,1,1,1,1,0,0,1,0,0,1}, /* 4 */
-        {1,1,1,1,0,0,1,1,1,0,0,1,1,1,1}, /* 5 */
-        {1,1,1,1,0,0,1,1,1,1,0,1,1,1,1}, /* 6 */
-        {1,1,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 7 */
-        {1,1,1,1,0,1,1,1,1,1,0,1,1,1,1}, /* 8 */
-        {1,1,1,1,0,1,1,1,1,0,0,1,1,1,1}, /* 9 */
-};
+/* Digit fonts, the first the default (see --font) */
+#include "fonts.h"
 
 #endif /* TTYCLOCK_H_INCLUDED */